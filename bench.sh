@@ -0,0 +1,32 @@
+#!/bin/sh
+#
+# (c) 2009, 2010 Alexander Holler
+# See the file COPYING for copying permission.
+#
+# Runs wp2git (step 1 and step 2, the output goes to /dev/null) against
+# synthetic dumps of several sizes and prints the throughput and the peak
+# memory. The dumps are kept in the working directory and reused.
+#
+# usage: bench.sh <wp2git-gen> <wp2git> [pages...]
+
+gen=$1
+wp2git=$2
+shift 2
+scales=${*:-"1000 10000 100000"}
+
+printf "%8s %10s %10s %8s %10s %10s %10s\n" pages revisions "text MB" seconds "revs/s" "MB/s" "peak MB"
+for pages in $scales; do
+    dump=bench-$pages.xml.bz2
+    if [ ! -f $dump ]; then
+        $gen -p $pages -r 10 -s 3000 --skew 3600 -o $dump 2>$dump.stats || exit 1
+    fi
+    $wp2git --report-interval 0 --metrics bench-$pages.json $dump >/dev/null 2>bench-$pages.log || exit 1
+    # Wrote 1000 pages with 10041 revisions (54214016 bytes of text).
+    revisions=$(sed -n 's/.* with \([0-9]*\) revisions.*/\1/p' $dump.stats)
+    bytes=$(sed -n 's/.*(\([0-9]*\) bytes of text.*/\1/p' $dump.stats)
+    seconds=$(sed -n 's/.*"wall_seconds": \([0-9.e+-]*\),$/\1/p' bench-$pages.json | head -n 1)
+    rss=$(sed -n 's/.*"max_rss_bytes": \([0-9]*\).*/\1/p' bench-$pages.json)
+    awk -v p=$pages -v r=$revisions -v b=$bytes -v s=$seconds -v m=$rss 'BEGIN {
+        printf "%8d %10d %10.1f %8.2f %10.0f %10.1f %10.1f\n",
+            p, r, b/1048576, s, r/s, b/1048576/s, m/1048576 }'
+done
@@ -0,0 +1,217 @@
+// (c) 2009, 2010 Alexander Holler
+// See the file COPYING for copying permission.
+
+#include "cache.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include <zlib.h>
+
+// The inflated size after which a new block is started (before the next
+// page or revision).
+static const size_t blockSize(4 << 20);
+// Marks a block which continues the page of the block before.
+static const uint32_t continuedBit(0x80000000UL);
+
+CacheWriter::CacheWriter(const std::string& name)
+    : filename(name)
+    , offset(8)
+    , continued(false)
+{
+    file.open(filename.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    write("WP2GCAC1");
+}
+
+CacheWriter::~CacheWriter()
+{
+    flush();
+    std::string str;
+    put(str, index.size(), 8);
+    for( size_t i = 0; i < index.size(); ++i ) {
+        put(str, index[i].id, 8);
+        put(str, index[i].block, 8);
+        put(str, index[i].title.size(), 4);
+        str += index[i].title;
+    }
+    put(str, offset, 8);
+    str += "WP2GIDX1";
+    write(str);
+    file.close();
+}
+
+void CacheWriter::beginPage(void)
+{
+    // A block continuing a page contains only the rest of that page, a
+    // reader might skip the block before.
+    if( continued || block.size() >= blockSize )
+        flush();
+    continued = false;
+}
+
+void CacheWriter::beginRevision(void)
+{
+    if( block.size() >= blockSize ) {
+        flush();
+        continued = true;
+    }
+}
+
+void CacheWriter::indexPage(uint64_t id, const std::string& title)
+{
+    index.push_back(Page(id, offset, title));
+}
+
+void CacheWriter::flush(void)
+{
+    if( block.empty() )
+        return;
+    if( block.size() >= continuedBit ) {
+        std::cerr << "ERROR: A revision is too large for the cache!" << std::endl;
+        exit(4);
+    }
+    uLongf size(compressBound(block.size()));
+    std::string deflated;
+    put(deflated, 0, 8);
+    deflated.resize(8 + size);
+    if( compress2((Bytef*)&deflated[8], &size, (const Bytef*)block.data(), block.size(),
+            Z_DEFAULT_COMPRESSION) != Z_OK ) {
+        std::cerr << "ERROR: Can't compress a block of the cache!" << std::endl;
+        exit(4);
+    }
+    deflated.resize(8 + size);
+    std::string sizes;
+    put(sizes, size, 4);
+    put(sizes, block.size() | ( continued ? continuedBit : 0 ), 4);
+    deflated.replace(0, 8, sizes);
+    write(deflated);
+    offset += deflated.size();
+    block.clear();
+}
+
+void CacheWriter::write(const std::string& data)
+{
+    file.write(data.data(), data.size());
+    if( ! file ) {
+        std::cerr << "ERROR: Can't write to file '" << filename << "'!" << std::endl;
+        exit(2);
+    }
+}
+
+void CacheWriter::put(std::string& str, uint64_t v, unsigned bytes)
+{
+    for( unsigned i = 0; i < bytes; ++i )
+        str += char(v >> (i*8));
+}
+
+CacheReader::CacheReader(const std::string& name)
+    : filename(name)
+    , offset(8)
+    , indexOffset(0)
+    , fileSize(0)
+    , pos(0)
+{
+    file.open(filename.c_str(), std::ios_base::in | std::ios_base::binary);
+    if( ! file ) {
+        std::cerr << "ERROR: Can't open file '" << filename << "'!" << std::endl;
+        exit(2);
+    }
+    char buf[16];
+    file.read(buf, 8);
+    if( ! file || memcmp(buf, "WP2GCAC1", 8) )
+        corrupt();
+    file.seekg(0, std::ios_base::end);
+    fileSize = file.tellg();
+    file.seekg(fileSize - 16);
+    file.read(buf, 16);
+    if( ! file || memcmp(buf+8, "WP2GIDX1", 8) )
+        corrupt();
+    indexOffset = get(buf, 8);
+    std::vector<char> data(fileSize - 16 - indexOffset);
+    file.seekg(indexOffset);
+    file.read(&data[0], data.size());
+    if( ! file || data.size() < 8 )
+        corrupt();
+    const char* p = &data[0];
+    const char* end = p + data.size();
+    index.resize(get(p, 8));
+    p += 8;
+    for( size_t i = 0; i < index.size(); ++i ) {
+        if( end - p < 20 )
+            corrupt();
+        index[i].id = get(p, 8);
+        index[i].block = get(p+8, 8);
+        size_t size = get(p+16, 4);
+        p += 20;
+        if( size_t(end - p) < size )
+            corrupt();
+        index[i].title.assign(p, size);
+        p += size;
+    }
+}
+
+CacheReader::Event CacheReader::next(unsigned char& element, const char*& text, size_t& size)
+{
+    if( pos == block.size() && ! readBlock() )
+        return Event_eof;
+    if( block[pos] ) {
+        element = (unsigned char)block[pos++] - 1;
+        return Event_start;
+    }
+    if( block.size() - pos < 5 )
+        corrupt();
+    size = get(&block[pos+1], 4);
+    pos += 5;
+    if( block.size() - pos < size )
+        corrupt();
+    text = &block[pos];
+    pos += size;
+    return Event_end;
+}
+
+bool CacheReader::readBlock(void)
+{
+    if( offset >= indexOffset )
+        return false;
+    char buf[8];
+    file.seekg(offset);
+    file.read(buf, 8);
+    // The first block is always read, it contains the start of the dump.
+    // offset is just behind the last read block, so a block continuing
+    // its page is read too.
+    if( ! wanted.empty() && offset > 8 && ! ( get(buf+4, 4) & continuedBit ) ) {
+        std::set<uint64_t>::const_iterator i(wanted.lower_bound(offset));
+        if( i == wanted.end() || *i >= indexOffset )
+            return false;
+        if( *i != offset ) {
+            offset = *i;
+            file.seekg(offset);
+            file.read(buf, 8);
+        }
+    }
+    deflated.resize(get(buf, 4));
+    block.resize(get(buf+4, 4) & ~continuedBit);
+    file.read(&deflated[0], deflated.size());
+    uLongf size(block.size());
+    if( ! file || uncompress((Bytef*)&block[0], &size, (const Bytef*)&deflated[0],
+            deflated.size()) != Z_OK || size != block.size() )
+        corrupt();
+    offset += 8 + deflated.size();
+    pos = 0;
+    return true;
+}
+
+uint64_t CacheReader::get(const char* p, unsigned bytes) const
+{
+    uint64_t v(0);
+    for( unsigned i = 0; i < bytes; ++i )
+        v |= uint64_t((unsigned char)p[i]) << (i*8);
+    return v;
+}
+
+void CacheReader::corrupt(void) const
+{
+    std::cerr << "ERROR: The cache '" << filename << "' is corrupt!" << std::endl;
+    exit(1);
+}
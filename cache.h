@@ -0,0 +1,111 @@
+// (c) 2009, 2010 Alexander Holler
+// See the file COPYING for copying permission.
+//
+// A pre-parsed dump. It contains the elements wp2git has read from the
+// XML (as they have been started and ended, with the text of an element
+// at its end), so later runs can replay them without bzip2 and expat.
+//
+// The file starts with the magic "WP2GCAC1", followed by blocks. A block
+// consists of the size of the deflated data and the size of the inflated
+// data (32 bit each), followed by the data (deflated with zlib). Inside,
+// an element start is a byte (the element + 1), an element end is a 0
+// followed by the size of the text (32 bit) and the text. A new block is
+// started before a page or, if the page is large, before a revision. The
+// latter blocks have the highest bit of the inflated size set, they are
+// read together with the block before and contain only the rest of its
+// page.
+// After the last block the index follows: the number of pages (64 bit)
+// and for every page its id and the offset of its first block (64 bit each),
+// the size of the title (32 bit) and the title. The file ends with the
+// offset of the index (64 bit) and the magic "WP2GIDX1". Everything is
+// little endian.
+//
+#ifndef WP2GIT_CACHE_H
+#define WP2GIT_CACHE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <set>
+#include <fstream>
+
+class CacheWriter {
+    public:
+        // Creates (or truncates) the file, exits on failure.
+        explicit CacheWriter(const std::string& filename);
+        // Writes the last block and the index.
+        ~CacheWriter();
+        void start(unsigned char element) { block += char(element + 1); }
+        void end(const std::string& text) {
+            block += '\0';
+            put(block, text.size(), 4);
+            block += text;
+        }
+        // Has to be called before a page is started.
+        void beginPage(void);
+        // Has to be called before a revision is started.
+        void beginRevision(void);
+        // Adds the actual page to the index.
+        void indexPage(uint64_t id, const std::string& title);
+        uint64_t bytes(void) const { return offset; }
+    private:
+        class Page {
+            public:
+                Page(uint64_t i, uint64_t b, const std::string& t) : id(i), block(b), title(t) {}
+                uint64_t id;
+                uint64_t block;
+                std::string title;
+        };
+        void flush(void);
+        void write(const std::string& data);
+        static void put(std::string& str, uint64_t v, unsigned bytes);
+        std::string filename;
+        std::ofstream file;
+        std::string block; // the inflated actual block
+        uint64_t offset; // of the actual block
+        bool continued; // the actual block continues a page
+        std::vector<Page> index;
+};
+
+class CacheReader {
+    public:
+        class Page {
+            public:
+                uint64_t id;
+                uint64_t block;
+                std::string title;
+        };
+        // Opens the file and reads the index, exits on failure.
+        explicit CacheReader(const std::string& filename);
+        const std::vector<Page>& pages(void) const { return index; }
+        // If called, only the wanted blocks (and the first one) are read,
+        // together with the blocks continuing their last page.
+        void want(uint64_t block) { wanted.insert(block); }
+        enum Event {
+            Event_start,
+            Event_end,
+            Event_eof
+        };
+        // Returns the next event. For Event_start element is set, for
+        // Event_end text and size, which are valid upto the next call.
+        Event next(unsigned char& element, const char*& text, size_t& size);
+        // The position in the file (for the ETA) and its size.
+        uint64_t position(void) const { return offset; }
+        uint64_t size(void) const { return fileSize; }
+    private:
+        bool readBlock(void);
+        uint64_t get(const char* p, unsigned bytes) const;
+        void corrupt(void) const;
+        std::string filename;
+        std::ifstream file;
+        std::vector<Page> index;
+        std::set<uint64_t> wanted;
+        uint64_t offset; // of the next block
+        uint64_t indexOffset; // the end of the blocks
+        uint64_t fileSize;
+        std::vector<char> deflated;
+        std::vector<char> block;
+        size_t pos; // in block
+};
+
+#endif // WP2GIT_CACHE_H
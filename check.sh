@@ -0,0 +1,34 @@
+#!/bin/sh
+#
+# (c) 2009, 2010 Alexander Holler
+# See the file COPYING for copying permission.
+#
+# Imports synthetic dumps with git fast-import and fails if git doesn't
+# accept the stream. The dumps are chosen to hit the corners of the output
+# (many large texts, which fill the iovecs before the buffer). The dumps
+# are read from stdin, like in gen | wp2git | git fast-import.
+#
+# usage: check.sh <wp2git-gen> <wp2git>
+
+gen=$1
+wp2git=$2
+dir=$(mktemp -d wp2git-check.XXXXXX) || exit 1
+trap 'rm -rf $dir' EXIT
+
+check() {
+    name=$1
+    shift
+    $gen "$@" -o $dir/$name.xml 2>/dev/null || exit 1
+    rm -rf $dir/$name.git
+    git init -q --bare $dir/$name.git || exit 1
+    if ! $wp2git --report-interval 0 <$dir/$name.xml 2>$dir/$name.log |
+            git --git-dir=$dir/$name.git fast-import --quiet; then
+        echo "FAILED: $name ($*)"
+        exit 1
+    fi
+    echo "ok: $name"
+}
+
+check large-texts -p 800 -r 2 -s 40000 --text-sigma 0.1
+check texts-17k -p 1200 -r 1 -s 17000
+check small-texts -p 1000 -r 10 -s 3000 --skew 3600
@@ -0,0 +1,167 @@
+// (c) 2009, 2010 Alexander Holler
+// See the file COPYING for copying permission.
+
+#include "columns.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
+
+// The flags of a column.
+static const unsigned Flag_dictionary(1);
+static const unsigned Flag_string(2);
+
+// The columns in the order they have to be written.
+static const struct {
+    const char* name;
+    unsigned width; // of a number
+    unsigned flags;
+} columnDefs[] = {
+    { "page_id", 8, 0 },
+    { "title", 4, Flag_dictionary }, // incl. the namespace
+    { "revision_id", 8, 0 },
+    { "timestamp", 8, 0 }, // seconds since 1970
+    { "contributor_id", 8, 0 }, // 0 for an ip
+    { "username", 4, Flag_dictionary },
+    { "ip", 4, Flag_dictionary },
+    { "minor", 1, 0 },
+    { "comment", 8, Flag_string }, // nearly unique
+    { "text_size", 8, 0 },
+};
+
+class Columns::Column {
+    public:
+        Column(const std::string& d, const char* n, unsigned w, unsigned f)
+            : dir(d)
+            , name(n)
+            , width(w)
+            , flags(f)
+            , stringsSize(0)
+        {
+            filename = dir + '/' + name + ".col";
+            file.open(filename.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+            file.write("WP2GCOL1", 8);
+            put(width, 4);
+            put(flags, 4);
+            put(0, 8);
+            check();
+            if( flags & Flag_string ) {
+                strFilename = dir + '/' + name + ".str";
+                strFile.open(strFilename.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+                strFile.write("WP2GSTR1", 8);
+                if( ! strFile ) {
+                    std::cerr << "ERROR: Can't write to file '" << strFilename << "'!" << std::endl;
+                    exit(2);
+                }
+            }
+        }
+        void number(uint64_t value) {
+            put(value, width);
+        }
+        void string(const std::string& value) {
+            if( flags & Flag_string ) {
+                put(stringsSize, 8);
+                put(value.size(), 8);
+                strFile.write(value.data(), value.size());
+                stringsSize += value.size();
+                return;
+            }
+            Dictionary::const_iterator i(dict.find(value));
+            if( i == dict.end() ) {
+                if( strings.size() > 0xffffffffUL ) {
+                    std::cerr << "ERROR: Too many different strings for the column " << name << '!' << std::endl;
+                    exit(4);
+                }
+                i = dict.insert(std::make_pair(value, uint32_t(strings.size()))).first;
+                strings.push_back(&i->first);
+            }
+            put(i->second, 4);
+        }
+        void close(uint64_t rows) {
+            file.seekp(16);
+            put(rows, 8);
+            check();
+            file.close();
+            if( flags & Flag_string ) {
+                strFile.close();
+                if( ! strFile ) {
+                    std::cerr << "ERROR: Can't write to file '" << strFilename << "'!" << std::endl;
+                    exit(2);
+                }
+            }
+            if( ! ( flags & Flag_dictionary ) )
+                return;
+            filename = dir + '/' + name + ".dict";
+            file.open(filename.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+            file.write("WP2GDIC1", 8);
+            put(strings.size(), 8);
+            uint64_t offset(0);
+            put(offset, 8);
+            for( size_t i = 0; i < strings.size(); ++i ) {
+                offset += strings[i]->size();
+                put(offset, 8);
+            }
+            for( size_t i = 0; i < strings.size(); ++i )
+                file.write(strings[i]->data(), strings[i]->size());
+            check();
+            file.close();
+        }
+    private:
+        void put(uint64_t v, unsigned bytes) {
+            char b[8];
+            for( unsigned i = 0; i < bytes; ++i )
+                b[i] = char(v >> (i*8));
+            file.write(b, bytes);
+        }
+        void check(void) {
+            if( ! file ) {
+                std::cerr << "ERROR: Can't write to file '" << filename << "'!" << std::endl;
+                exit(2);
+            }
+        }
+        typedef std::tr1::unordered_map<std::string, uint32_t> Dictionary;
+        std::string dir;
+        std::string name;
+        std::string filename;
+        unsigned width;
+        unsigned flags;
+        std::ofstream file;
+        std::string strFilename;
+        std::ofstream strFile; // with Flag_string
+        uint64_t stringsSize; // written to strFile
+        Dictionary dict;
+        std::vector<const std::string*> strings; // in the order of their index
+};
+
+Columns::Columns(const std::string& dir)
+    : column(0)
+    , rows(0)
+{
+    if( mkdir(dir.c_str(), 0777) && errno != EEXIST ) {
+        std::cerr << "ERROR: Can't create the directory '" << dir << "'!" << std::endl;
+        exit(2);
+    }
+    for( size_t i = 0; i < sizeof(columnDefs) / sizeof(columnDefs[0]); ++i )
+        columns.push_back(new Column(dir, columnDefs[i].name, columnDefs[i].width,
+            columnDefs[i].flags));
+}
+
+Columns::~Columns()
+{
+    for( size_t i = 0; i < columns.size(); ++i ) {
+        columns[i]->close(rows);
+        delete columns[i];
+    }
+}
+
+void Columns::number(uint64_t value)
+{
+    columns[column++]->number(value);
+}
+
+void Columns::string(const std::string& value)
+{
+    columns[column++]->string(value);
+}
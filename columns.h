@@ -0,0 +1,49 @@
+// (c) 2009, 2010 Alexander Holler
+// See the file COPYING for copying permission.
+//
+// Writes the metadata of the revisions column by column into a directory,
+// one file per column, to be scanned with mmap() without parsing the dump
+// again.
+//
+// A column (name.col) starts with the magic "WP2GCOL1", the width of a
+// value in bytes (32 bit), the flags (32 bit, 1 = dictionary encoded,
+// 2 = string) and the number of rows (64 bit), followed by the values.
+// Strings repeating often are dictionary encoded: the column contains the
+// index (32 bit) of the string in name.dict. That file starts with the
+// magic "WP2GDIC1" and the number of strings (64 bit), followed by the
+// offsets of the strings (count+1 times 64 bit, relative to the end of the
+// offsets) and the strings themselves. Other strings (the comment) are
+// written to name.str, which starts with the magic "WP2GSTR1", followed by
+// the strings. Their column contains two values (64 bit) per row, the
+// offset of the string (relative to the end of the magic) and its size.
+// Everything is little endian and the values are aligned to their width.
+//
+#ifndef WP2GIT_COLUMNS_H
+#define WP2GIT_COLUMNS_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <tr1/unordered_map>
+
+class Columns {
+    public:
+        // Creates the directory (if necessary) and the files of all columns.
+        explicit Columns(const std::string& dir);
+        // Writes the dictionaries and the headers.
+        ~Columns();
+        // Has to be called for every column of a row in the order of the
+        // columns, see columns.cpp.
+        void number(uint64_t value);
+        void string(const std::string& value);
+        void endRow(void) { column = 0; ++rows; }
+        uint64_t count(void) const { return rows; }
+    private:
+        class Column;
+        std::vector<Column*> columns;
+        size_t column; // the next column of the actual row
+        uint64_t rows;
+};
+
+#endif // WP2GIT_COLUMNS_H
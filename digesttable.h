@@ -0,0 +1,68 @@
+// (c) 2009, 2010 Alexander Holler
+// See the file COPYING for copying permission.
+//
+// A compact hash table from SHA-1 digests to a number (e.g. a mark).
+// It uses open addressing and stores only the digest and the number,
+// that's 24 bytes per entry.
+//
+#ifndef WP2GIT_DIGESTTABLE_H
+#define WP2GIT_DIGESTTABLE_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <algorithm>
+#include <vector>
+
+class DigestTable {
+    public:
+        typedef unsigned char Digest[20]; // see sha1.h
+        DigestTable()
+            : used(0)
+            , table(1 << 16)
+            {}
+        // Returns the value stored for this digest or 0 if there is none.
+        unsigned long find(const Digest& digest) {
+            return lookup(table, digest)->value;
+        }
+        // value must not be 0.
+        void insert(const Digest& digest, unsigned long value) {
+            // If a value doesn't fit we just don't remember it.
+            if( value > 0xffffffffUL )
+                return;
+            Entry* e = lookup(table, digest);
+            std::copy(digest, digest+20, e->digest);
+            e->value = value;
+            if( ++used * 2 > table.size() )
+                grow();
+        }
+        size_t size(void) const { return used; }
+        // The memory used by the table.
+        size_t bytes(void) const { return table.size() * sizeof(Entry); }
+    private:
+        struct Entry {
+            Entry() : value(0) {}
+            unsigned char digest[20];
+            uint32_t value; // 0 = unused slot
+        };
+        typedef std::vector<Entry> Table;
+        static Entry* lookup(Table& t, const unsigned char* digest) {
+            // The digest is already well distributed.
+            size_t mask = t.size() - 1;
+            size_t i = ( size_t(digest[0]) << 24 | size_t(digest[1]) << 16
+                | size_t(digest[2]) << 8 | digest[3] ) & mask;
+            while( t[i].value && ! std::equal(digest, digest+20, t[i].digest) )
+                i = (i + 1) & mask;
+            return &t[i];
+        }
+        void grow(void) {
+            Table t(table.size() * 2);
+            for( Table::const_iterator i = table.begin(); i != table.end(); ++i )
+                if( i->value )
+                    *lookup(t, i->digest) = *i;
+            table.swap(t);
+        }
+        size_t used;
+        Table table;
+};
+
+#endif // WP2GIT_DIGESTTABLE_H
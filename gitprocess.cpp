@@ -0,0 +1,113 @@
+// (c) 2009, 2010 Alexander Holler
+// See the file COPYING for copying permission.
+//
+#include "gitprocess.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <boost/lexical_cast.hpp>
+
+GitProcess::GitProcess(const std::vector<std::string>& args, Pipe pipe)
+    : pid(-1)
+    , fd(-1)
+    , waitedSeconds(0)
+    , in(NULL)
+    , out(NULL)
+{
+    int fds[2];
+    if( ::pipe(fds) ) {
+        std::cerr << "ERROR: Can't create a pipe to git!" << std::endl;
+        exit(6);
+    }
+    std::vector<char*> argv;
+    argv.push_back(const_cast<char*>("git"));
+    for( size_t i = 0; i < args.size(); ++i )
+        argv.push_back(const_cast<char*>(args[i].c_str()));
+    argv.push_back(NULL);
+    // The end of the pipe used by git.
+    int child_end = pipe == Pipe_stdin ? 0 : 1;
+    pid = fork();
+    if( pid < 0 ) {
+        std::cerr << "ERROR: Can't start git " << args[0] << '!' << std::endl;
+        exit(6);
+    }
+    if( ! pid ) {
+        dup2(fds[child_end], child_end);
+        close(fds[0]);
+        close(fds[1]);
+        execvp(argv[0], &argv[0]);
+        std::cerr << "ERROR: Can't start git " << args[0] << '!' << std::endl;
+        _exit(127);
+    }
+    close(fds[child_end]);
+    fd = fds[1 - child_end];
+    if( pipe == Pipe_stdin )
+        // git reads from the pipe, so we can splice into it.
+        in = new Output(fd, "git " + args[0], true);
+    else
+        out = new boost::iostreams::stream<boost::iostreams::file_descriptor_source>(
+            fd, boost::iostreams::never_close_handle);
+}
+
+GitProcess::~GitProcess()
+{
+    wait();
+}
+
+int GitProcess::wait(void)
+{
+    if( pid < 0 )
+        return 0;
+    if( in ) {
+        in->flush();
+        waitedSeconds = in->waited();
+    }
+    delete in;
+    delete out;
+    in = NULL;
+    out = NULL;
+    close(fd);
+    int status;
+    while( waitpid(pid, &status, 0) < 0 )
+        if( errno != EINTR )
+            return 128;
+    pid = -1;
+    if( WIFEXITED(status) )
+        return WEXITSTATUS(status);
+    return 128;
+}
+
+unsigned long long GitProcess::rss(void) const
+{
+    if( pid < 0 )
+        return 0;
+    std::ifstream status(("/proc/" + boost::lexical_cast<std::string>(pid) + "/status").c_str());
+    std::string line;
+    while( std::getline(status, line) )
+        if( ! line.compare(0, 6, "VmRSS:") ) {
+            // VmRSS:    1234 kB
+            size_t start = line.find_first_not_of(" \t", 6);
+            size_t end = line.find(' ', start);
+            if( start == std::string::npos )
+                return 0;
+            return boost::lexical_cast<unsigned long long>(line.substr(start, end-start)) * 1024;
+        }
+    return 0;
+}
+
+std::string GitProcess::readLine(const std::vector<std::string>& args)
+{
+    GitProcess git(args, Pipe_stdout);
+    std::string line;
+    std::getline(git.output(), line);
+    // Read the rest to not let git die because of a broken pipe.
+    std::string rest;
+    while( std::getline(git.output(), rest) )
+        ;
+    git.wait();
+    return line;
+}
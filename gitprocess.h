@@ -0,0 +1,50 @@
+// (c) 2009, 2010 Alexander Holler
+// See the file COPYING for copying permission.
+//
+// Starts git (e.g. git fast-import) as a child process, with a pipe to
+// its stdin or from its stdout. The environment (GIT_DIR) is inherited.
+#ifndef WP2GIT_GITPROCESS_H
+#define WP2GIT_GITPROCESS_H
+
+#include <sys/types.h>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include <boost/iostreams/stream.hpp>
+#include <boost/iostreams/device/file_descriptor.hpp>
+
+#include "output.h"
+
+class GitProcess {
+    public:
+        enum Pipe {
+            Pipe_stdin,
+            Pipe_stdout,
+        };
+        // args are the arguments for git, e.g. "fast-import", "--quiet".
+        GitProcess(const std::vector<std::string>& args, Pipe pipe);
+        ~GitProcess();
+        // Only with Pipe_stdin.
+        Output& input(void) { return *in; }
+        // Only with Pipe_stdout.
+        std::istream& output(void) { return *out; }
+        // Closes the pipe and waits for git, returns its exit code.
+        int wait(void);
+        // Seconds spent waiting for git to read from its stdin.
+        double waited(void) const { return in ? in->waited() : waitedSeconds; }
+        // The resident set size of git in bytes (0 if unknown).
+        unsigned long long rss(void) const;
+
+        // Runs git and returns the first line it has written.
+        static std::string readLine(const std::vector<std::string>& args);
+
+    private:
+        pid_t pid;
+        int fd;
+        double waitedSeconds;
+        Output* in;
+        boost::iostreams::stream<boost::iostreams::file_descriptor_source>* out;
+};
+
+#endif // WP2GIT_GITPROCESS_H
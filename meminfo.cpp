@@ -0,0 +1,59 @@
+// (c) 2009, 2010 Alexander Holler
+// See the file COPYING for copying permission.
+
+#include <cstdio>
+#include <cstring>
+
+#include "meminfo.h"
+
+// Reads a line like "VmRSS:    1234 kB" from /proc/self/status.
+static uint64_t status(const char* key)
+{
+    std::FILE* f = std::fopen("/proc/self/status", "r");
+    if( ! f )
+        return 0;
+    char line[256];
+    size_t len = std::strlen(key);
+    unsigned long long kb(0);
+    while( std::fgets(line, sizeof(line), f) )
+        if( ! std::strncmp(line, key, len) && line[len] == ':' ) {
+            std::sscanf(line + len + 1, "%llu", &kb);
+            break;
+        }
+    std::fclose(f);
+    return kb * 1024;
+}
+
+uint64_t rssBytes(void)
+{
+    return status("VmRSS");
+}
+
+uint64_t peakRssBytes(void)
+{
+    return status("VmHWM");
+}
+
+static uint64_t readNumber(const char* filename)
+{
+    std::FILE* f = std::fopen(filename, "r");
+    if( ! f )
+        return 0;
+    unsigned long long n(0);
+    // cgroup v2 writes "max" if there is no limit.
+    if( std::fscanf(f, "%llu", &n) != 1 )
+        n = 0;
+    std::fclose(f);
+    return n;
+}
+
+uint64_t cgroupLimitBytes(void)
+{
+    uint64_t limit = readNumber("/sys/fs/cgroup/memory.max");
+    if( ! limit )
+        limit = readNumber("/sys/fs/cgroup/memory/memory.limit_in_bytes");
+    // cgroup v1 uses a huge number if there is no limit.
+    if( limit >= (uint64_t(1) << 60) )
+        return 0;
+    return limit;
+}
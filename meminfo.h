@@ -0,0 +1,18 @@
+// (c) 2009, 2010 Alexander Holler
+// See the file COPYING for copying permission.
+//
+// What the kernel tells about our memory usage and limits.
+//
+#ifndef WP2GIT_MEMINFO_H
+#define WP2GIT_MEMINFO_H
+
+#include <stdint.h>
+
+// Our resident set size and its peak in bytes (0 if unknown).
+uint64_t rssBytes(void);
+uint64_t peakRssBytes(void);
+
+// The memory limit of our cgroup in bytes (0 if none).
+uint64_t cgroupLimitBytes(void);
+
+#endif // WP2GIT_MEMINFO_H
@@ -0,0 +1,184 @@
+// (c) 2009, 2010 Alexander Holler
+// See the file COPYING for copying permission.
+
+#include <time.h>
+#include <sys/resource.h>
+#include <cstdio>
+#include <algorithm>
+#include <fstream>
+
+#include "metrics.h"
+
+static const char* stageNames[Metrics::Stage_count] = {
+    "decompress",
+    "parse",
+    "hash",
+    "blob_output",
+    "commit_build",
+    "sort",
+    "commit_output",
+    "pack_finish",
+};
+
+// The number of largest pages and revisions kept.
+static const size_t largestCount(10);
+
+static uint64_t nanoseconds(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+uint64_t Metrics::wallNow(void)
+{
+    return nanoseconds(CLOCK_MONOTONIC);
+}
+
+uint64_t Metrics::cpuNow(void)
+{
+    return nanoseconds(CLOCK_THREAD_CPUTIME_ID);
+}
+
+Metrics::Metrics()
+    : enabled(false)
+    , running(NULL)
+    , histogram(32)
+{
+}
+
+Metrics::Timer::Timer(Metrics& m, Stage s)
+    : metrics(m)
+    , stage(s)
+    , parent(NULL)
+    , nestedWall(0)
+    , nestedCpu(0)
+{
+    if( ! metrics.enabled ) {
+        stage = Stage_count;
+        return;
+    }
+    parent = metrics.running;
+    metrics.running = this;
+    wall = wallNow();
+    cpu = cpuNow();
+}
+
+Metrics::Timer::~Timer()
+{
+    if( stage == Stage_count )
+        return;
+    uint64_t w = wallNow() - wall;
+    uint64_t c = cpuNow() - cpu;
+    Times& t = metrics.times[stage];
+    t.wall += w - std::min(w, nestedWall);
+    t.cpu += c - std::min(c, nestedCpu);
+    ++t.calls;
+    if( parent ) {
+        parent->nestedWall += w;
+        parent->nestedCpu += c;
+    }
+    metrics.running = parent;
+}
+
+void Metrics::revision(uint64_t ns)
+{
+    uint64_t us = ns / 1000;
+    size_t bucket(0);
+    while( us && bucket < histogram.size()-1 ) {
+        us >>= 1;
+        ++bucket;
+    }
+    ++histogram[bucket];
+}
+
+void Metrics::keepLargest(Largest& l, uint64_t size, const std::string& what)
+{
+    if( l.size() == largestCount && size <= l.front().first )
+        return;
+    if( l.size() == largestCount )
+        l.erase(l.begin());
+    l.insert(std::upper_bound(l.begin(), l.end(), std::make_pair(size, std::string())),
+        std::make_pair(size, what));
+}
+
+void Metrics::revisionSize(unsigned long id, uint64_t size)
+{
+    if( enabled && ( largestRevisions.size() < largestCount || size > largestRevisions.front().first ) ) {
+        char buf[24];
+        snprintf(buf, sizeof(buf), "%lu", id);
+        keepLargest(largestRevisions, size, buf);
+    }
+}
+
+void Metrics::pageSize(const std::string& title, uint64_t size)
+{
+    if( enabled )
+        keepLargest(largestPages, size, title);
+}
+
+static std::string jsonString(const std::string& s)
+{
+    std::string r("\"");
+    for( size_t i = 0; i < s.size(); ++i ) {
+        unsigned char c = s[i];
+        if( c == '"' || c == '\\' ) {
+            r += '\\';
+            r += c;
+        }
+        else if( c < 0x20 ) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            r += buf;
+        }
+        else
+            r += c;
+    }
+    return r + '"';
+}
+
+static void writeLargest(std::ostream& o, const char* name, const char* key,
+    const std::vector< std::pair<uint64_t, std::string> >& l, bool quote)
+{
+    o << "  \"" << name << "\": [";
+    for( size_t i = l.size(); i--; ) {
+        o << "\n    { \"" << key << "\": " << (quote ? jsonString(l[i].second) : l[i].second)
+            << ", \"bytes\": " << l[i].first << " }";
+        if( i )
+            o << ',';
+    }
+    o << (l.empty() ? "],\n" : "\n  ],\n");
+}
+
+bool Metrics::write(const std::string& filename, double wallSeconds) const
+{
+    std::ofstream o(filename.c_str());
+    o << "{\n  \"wall_seconds\": " << wallSeconds << ",\n";
+    struct rusage ru;
+    if( ! getrusage(RUSAGE_SELF, &ru) )
+        o << "  \"user_seconds\": " << ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6
+            << ",\n  \"system_seconds\": " << ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6
+            << ",\n  \"max_rss_bytes\": " << uint64_t(ru.ru_maxrss) * 1024 << ",\n";
+    o << "  \"stages\": {";
+    for( unsigned s = 0; s < Stage_count; ++s )
+        o << (s ? ",\n" : "\n") << "    \"" << stageNames[s] << "\": { \"wall_seconds\": "
+            << times[s].wall / 1e9 << ", \"cpu_seconds\": " << times[s].cpu / 1e9
+            << ", \"calls\": " << times[s].calls << " }";
+    o << "\n  },\n  \"waited_seconds\": {";
+    for( std::map<std::string, double>::const_iterator i = waitedFor.begin(); i != waitedFor.end(); ++i )
+        o << (i == waitedFor.begin() ? "\n" : ",\n") << "    " << jsonString(i->first) << ": " << i->second;
+    o << "\n  },\n";
+    // Only the used buckets.
+    size_t used = histogram.size();
+    while( used && ! histogram[used-1] )
+        --used;
+    o << "  \"revision_latency_us\": [";
+    for( size_t i = 0; i < used; ++i )
+        o << (i ? ", " : "") << "{ \"below\": " << (uint64_t(1) << i) << ", \"count\": " << histogram[i] << " }";
+    o << "],\n";
+    writeLargest(o, "largest_revisions", "id", largestRevisions, false);
+    writeLargest(o, "largest_pages", "title", largestPages, true);
+    o << "  \"version\": 1\n}\n";
+    o.close();
+    return o.good();
+}
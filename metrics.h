@@ -0,0 +1,88 @@
+// (c) 2009, 2010 Alexander Holler
+// See the file COPYING for copying permission.
+//
+// Collects where the time goes (wall and cpu time per stage, measured in
+// the thread the stage runs in), a histogram of the time needed for a
+// revision and the largest pages and revisions. Everything is written as
+// JSON at the end.
+//
+// Stages might be nested (e.g. the blob output happens inside the XML
+// parser), a stage only counts the time not spent in nested stages.
+// Timers are only used by the main thread. Nothing is measured if the
+// Metrics are not enabled.
+//
+#ifndef WP2GIT_METRICS_H
+#define WP2GIT_METRICS_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+
+class Metrics {
+    public:
+        enum Stage {
+            Stage_decompress,
+            Stage_parse,
+            Stage_hash,
+            Stage_blob,
+            Stage_build,
+            Stage_sort,
+            Stage_commit,
+            Stage_pack,
+            Stage_count
+        };
+
+        Metrics();
+        void enable(void) { enabled = true; }
+        bool isEnabled(void) const { return enabled; }
+
+        // Measures a stage as long as it exists.
+        class Timer {
+            public:
+                Timer(Metrics& m, Stage s);
+                ~Timer();
+            private:
+                Metrics& metrics;
+                Stage stage;
+                Timer* parent;
+                uint64_t wall;
+                uint64_t cpu;
+                uint64_t nestedWall;
+                uint64_t nestedCpu;
+        };
+
+        // A revision needed ns nanoseconds.
+        void revision(uint64_t ns);
+        void revisionSize(unsigned long id, uint64_t size);
+        void pageSize(const std::string& title, uint64_t size);
+        void waited(const std::string& what, double seconds) { waitedFor[what] += seconds; }
+
+        // Returns false if the file couldn't be written.
+        bool write(const std::string& filename, double wallSeconds) const;
+
+        static uint64_t wallNow(void);
+        static uint64_t cpuNow(void);
+
+    private:
+        struct Times {
+            Times() : wall(0), cpu(0), calls(0) {}
+            uint64_t wall;
+            uint64_t cpu;
+            uint64_t calls;
+        };
+        // The largest ones, smallest first.
+        typedef std::vector< std::pair<uint64_t, std::string> > Largest;
+        static void keepLargest(Largest& l, uint64_t size, const std::string& what);
+
+        bool enabled;
+        Times times[Stage_count];
+        Timer* running;
+        // Bucket n counts revisions needing < 2^n microseconds.
+        std::vector<uint64_t> histogram;
+        Largest largestRevisions;
+        Largest largestPages;
+        std::map<std::string, double> waitedFor;
+};
+
+#endif // WP2GIT_METRICS_H
@@ -0,0 +1,210 @@
+// (c) 2009, 2010 Alexander Holler
+// See the file COPYING for copying permission.
+//
+// Measures the functions wp2git calls for every revision (or even more
+// often) in isolation and prints ns/op and allocations/op.
+//
+// Most of wp2git consists of static functions working on static
+// variables, therefor we include wp2git.cpp instead of linking it.
+//
+
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#define main wp2git_main
+#include "wp2git.cpp"
+#undef main
+
+static uint64_t allocations(0);
+
+void* operator new(size_t size)
+{
+    ++allocations;
+    void* p = std::malloc(size ? size : 1);
+    if( ! p )
+        throw std::bad_alloc();
+    return p;
+}
+
+// GCC sees free() on what operator new returned, but our new uses malloc().
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+#pragma GCC diagnostic pop
+
+static uint64_t nanoseconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// Used to keep the compiler from removing what we measure.
+static volatile size_t sink;
+
+// Realistic titles (multibyte UTF-8 included).
+static const char* titles[] = {
+    "Albert Einstein",
+    "Liste der Baudenkmäler in München/Maxvorstadt",
+    "Zürich",
+    "C++",
+    "Diskussion über Straßenbahn (Begriffsklärung)",
+    "Ελληνική γλώσσα",
+};
+static const size_t titleCount(sizeof(titles) / sizeof(titles[0]));
+static size_t round_(0);
+
+static void benchAsciiizeChar(void)
+{
+    const char* t = titles[round_++ % titleCount];
+    for( ; *t; ++t )
+        sink += asciiize_char(*t).size();
+}
+
+static void benchAsciiize(void)
+{
+    sink += asciiize(titles[round_++ % titleCount]).size();
+}
+
+static void benchTimestamp(void)
+{
+    sink += time_t_from_timestamp();
+}
+
+static void benchBuildCommitString(void)
+{
+    title = titles[round_++ % titleCount];
+    sink += buildCommitString(1259669371, 123456789).size();
+}
+
+static Output* devNull;
+static std::string commitText;
+
+static void benchOutputCommit(void)
+{
+    sink += output_commit(*devNull, "refs/heads/master", commitText, ":1234567", "", 1234568).size();
+}
+
+static const char* elementNames[] = {
+    "page", "title", "ns", "id", "revision", "id", "parentid", "timestamp",
+    "contributor", "username", "id", "minor", "comment", "model", "format",
+    "text", "sha1",
+};
+static const size_t elementCount(sizeof(elementNames) / sizeof(elementNames[0]));
+
+static void benchElementDispatch(void)
+{
+    const char* name = elementNames[round_++ % elementCount];
+    sink += mapElementNames.find(name) != mapElementNames.end();
+}
+
+static void benchStartEndElement(void)
+{
+    // A comment below a revision.
+    startElement(NULL, "comment", NULL);
+    characterHandler(NULL, "typo", 4);
+    endElement(NULL, "comment");
+}
+
+// expat delivers texts in pieces, usually upto the next newline or entity.
+static std::string textLine(std::string(72, 'x') + '\n');
+
+static void benchCharacterHandler(void)
+{
+    actualValue.clear();
+    for( unsigned i = 0; i < 64; ++i )
+        characterHandler(NULL, textLine.data(), textLine.size());
+    sink += actualValue.size();
+}
+
+static std::vector<std::streampos> positions;
+
+static void benchWriteString(void)
+{
+    positions.push_back(writeString(commitText));
+}
+
+static void benchReadString(void)
+{
+    sink += readString(positions[round_++ % positions.size()]).size();
+}
+
+static void run(const char* name, void (*f)(void))
+{
+    // Warm up.
+    for( unsigned i = 0; i < 100; ++i )
+        f();
+    uint64_t ops(0);
+    uint64_t allocs = allocations;
+    uint64_t start = nanoseconds();
+    uint64_t elapsed;
+    do {
+        for( unsigned i = 0; i < 1000; ++i )
+            f();
+        ops += 1000;
+        elapsed = nanoseconds() - start;
+    } while( elapsed < 200000000 );
+    allocs = allocations - allocs;
+    std::printf("%-28s %10.1f ns/op %8.2f allocs/op\n", name,
+        double(elapsed) / ops, double(allocs) / ops);
+}
+
+int main(void)
+{
+    initMap();
+    // A typical revision.
+    title_ns = "Diskussion";
+    id_page = "4711";
+    id_revision = "62133749";
+    id_contributor = "123456";
+    username = "Alexander Holler";
+    comment = "/* Weblinks */ Tippfehler korrigiert";
+    is_minor = true;
+    title = titles[0];
+    timestamp = "2009-12-01T12:09:31Z";
+    commitText = buildCommitString(1259669371, 123456789);
+    // The stack as it is below a revision.
+    elementStack.push(Element_unknown);
+    elementStack.push(Element_unknown);
+    elementStack.push(Element_revision);
+
+    int fd = open("/dev/null", O_WRONLY);
+    devNull = new Output(fd, "/dev/null");
+
+    run("asciiize_char (per title)", benchAsciiizeChar);
+    run("asciiize", benchAsciiize);
+    run("time_t_from_timestamp", benchTimestamp);
+    run("buildCommitString", benchBuildCommitString);
+    run("output_commit", benchOutputCommit);
+    run("element dispatch", benchElementDispatch);
+    run("start/char/endElement", benchStartEndElement);
+    run("characterHandler (64 lines)", benchCharacterHandler);
+
+    char name[] = "/tmp/wp2git-microbench-XXXXXX";
+    int tfd = mkstemp(name);
+    if( tfd < 0 ) {
+        std::cerr << "ERROR: Can't create a temporary file!" << std::endl;
+        return 2;
+    }
+    close(tfd);
+    tempfilename = name;
+    openTfile();
+    unlink(name);
+    run("writeString", benchWriteString);
+    run("readString", benchReadString);
+
+    devNull->flush();
+    return 0;
+}
@@ -0,0 +1,311 @@
+// (c) 2009, 2010 Alexander Holler
+// See the file COPYING for copying permission.
+//
+#include "output.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <limits.h> // IOV_MAX
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+static const size_t bufferSize(64*1024);
+// Smaller texts are copied, splicing them would waste slots of the pipe.
+static const size_t spliceThreshold(16*1024);
+// We try to enlarge pipes to this size.
+static const int pipeSize(1024*1024);
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+size_t FdSink::pipeSlots(void)
+{
+#ifdef __linux__
+    struct stat st;
+    if( ! fstat(fd, &st) && S_ISFIFO(st.st_mode) ) {
+        fcntl(fd, F_SETPIPE_SZ, pipeSize); // Not fatal if this fails.
+        int size = fcntl(fd, F_GETPIPE_SZ);
+        if( size > 0 )
+            return size / sysconf(_SC_PAGESIZE);
+    }
+#endif
+    return 0;
+}
+
+ssize_t FdSink::splice(const struct iovec* v)
+{
+#ifdef __linux__
+    return vmsplice(fd, v, 1, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+FileSink::FileSink(const std::string& filename)
+    : FdSink(open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666))
+{
+    if( fd < 0 ) {
+        std::cerr << "ERROR: Can't open file '" << filename << "'!" << std::endl;
+        exit(2);
+    }
+}
+
+FileSink::~FileSink()
+{
+    close(fd);
+}
+
+GzipSink::GzipSink(const std::string& filename)
+    : file(gzopen(filename.c_str(), "wb"))
+{
+    if( ! file ) {
+        std::cerr << "ERROR: Can't open file '" << filename << "'!" << std::endl;
+        exit(2);
+    }
+    gzbuffer(file, 256*1024);
+}
+
+GzipSink::~GzipSink()
+{
+    gzclose(file);
+}
+
+ssize_t GzipSink::write(const struct iovec* v, int count)
+{
+    ssize_t written(0);
+    for( int i = 0; i < count; ++i ) {
+        if( ! v[i].iov_len )
+            continue;
+        int rc = gzwrite(file, v[i].iov_base, v[i].iov_len);
+        if( rc <= 0 ) {
+            errno = EIO;
+            return -1;
+        }
+        written += rc;
+    }
+    return written;
+}
+
+ssize_t NullSink::write(const struct iovec* v, int count)
+{
+    ssize_t written(0);
+    for( int i = 0; i < count; ++i )
+        written += v[i].iov_len;
+    return written;
+}
+
+template<class Sink>
+BasicOutput<Sink>::BasicOutput(const typename Sink::Arg& arg, const std::string& n, bool splice)
+    : sink(arg)
+    , name(n)
+    , isPipe(false)
+    , pipeSlots(0)
+    , splicedPages(0)
+    , waitedSeconds(0)
+    , buffer(bufferSize)
+    , bufferUsed(0)
+{
+    pipeSlots = sink.pipeSlots();
+    isPipe = splice && pipeSlots;
+}
+
+template<class Sink>
+BasicOutput<Sink>::~BasicOutput()
+{
+    flush();
+    // The spliced texts might still be referenced by the pipe, we don't
+    // free them in case the reader didn't consume everything up to now.
+    if( ! spliced.empty() )
+        (new std::deque<Spliced>)->swap(spliced);
+}
+
+template<class Sink>
+void BasicOutput<Sink>::fatal(void)
+{
+    std::cerr << "ERROR: Can't write to " << name << '!' << std::endl;
+    exit(6);
+}
+
+template<class Sink>
+void BasicOutput<Sink>::add(const char* data, size_t len)
+{
+    // No flush() here, the callers have already placed the data (in the
+    // buffer or in texts), which flush() would release. They are making
+    // room before (see full()).
+    // Parts of the buffer written one after another are merged.
+    if( ! iovecs.empty() && static_cast<char*>(iovecs.back().iov_base) + iovecs.back().iov_len == data )
+        iovecs.back().iov_len += len;
+    else {
+        struct iovec v;
+        v.iov_base = const_cast<char*>(data);
+        v.iov_len = len;
+        iovecs.push_back(v);
+    }
+}
+
+template<class Sink>
+bool BasicOutput<Sink>::full(void) const
+{
+    return iovecs.size() >= IOV_MAX;
+}
+
+template<class Sink>
+void BasicOutput<Sink>::write(const char* data, size_t len)
+{
+    if( full() )
+        flush();
+    if( bufferUsed + len > buffer.size() ) {
+        flush();
+        if( len > buffer.size() ) {
+            add(data, len);
+            flush();
+            return;
+        }
+    }
+    std::memcpy(&buffer[bufferUsed], data, len);
+    add(&buffer[bufferUsed], len);
+    bufferUsed += len;
+}
+
+template<class Sink>
+void BasicOutput<Sink>::writeNumber(unsigned long long n)
+{
+    char s[24];
+    char* p = s + sizeof(s);
+    do {
+        *--p = '0' + n % 10;
+        n /= 10;
+    } while( n );
+    write(p, s + sizeof(s) - p);
+}
+
+template<class Sink>
+void BasicOutput<Sink>::release(std::string& text)
+{
+    text.clear();
+    unused.push_back(std::string());
+    unused.back().swap(text);
+}
+
+template<class Sink>
+void BasicOutput<Sink>::writeText(std::string& text)
+{
+    std::string t;
+    if( ! unused.empty() ) {
+        t.swap(unused.back());
+        unused.pop_back();
+    }
+    t.swap(text);
+    if( t.size() < spliceThreshold ) {
+        write(t);
+        release(t);
+    }
+    else if( isPipe )
+        splice(t);
+    else {
+        if( full() )
+            flush();
+        texts.push_back(std::string());
+        texts.back().swap(t);
+        add(texts.back().data(), texts.back().size());
+    }
+}
+
+template<class Sink>
+void BasicOutput<Sink>::splice(std::string& text)
+{
+    flush();
+    boost::posix_time::ptime start(boost::posix_time::microsec_clock::universal_time());
+    struct iovec v;
+    v.iov_base = const_cast<char*>(text.data());
+    v.iov_len = text.size();
+    while( v.iov_len ) {
+        ssize_t rc = sink.splice(&v);
+        if( rc < 0 ) {
+            if( errno == EINTR )
+                continue;
+            if( v.iov_len != text.size() )
+                fatal();
+            // Not supported, use writev() from now on.
+            isPipe = false;
+            texts.push_back(std::string());
+            texts.back().swap(text);
+            add(texts.back().data(), texts.back().size());
+            return;
+        }
+        v.iov_base = static_cast<char*>(v.iov_base) + rc;
+        v.iov_len -= rc;
+    }
+    waitedSeconds += (boost::posix_time::microsec_clock::universal_time() - start)
+        .total_microseconds() / 1e6;
+    // Every page is using (at least) one slot of the pipe. If as many
+    // pages as the pipe can hold were spliced after a text, the reader
+    // must have consumed it.
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t misalign = reinterpret_cast<uintptr_t>(text.data()) % page;
+    splicedPages += (misalign + text.size() + page - 1) / page;
+    while( ! spliced.empty() && spliced.front().releaseAt <= splicedPages ) {
+        release(spliced.front().text);
+        spliced.pop_front();
+    }
+    spliced.push_back(Spliced());
+    spliced.back().text.swap(text);
+    spliced.back().releaseAt = splicedPages + pipeSlots;
+}
+
+template<class Sink>
+void BasicOutput<Sink>::flush(void)
+{
+    boost::posix_time::ptime start(boost::posix_time::microsec_clock::universal_time());
+    struct iovec* v = iovecs.empty() ? NULL : &iovecs[0];
+    size_t count = iovecs.size();
+    while( count ) {
+        ssize_t rc = sink.write(v, count);
+        if( rc < 0 ) {
+            if( errno == EINTR )
+                continue;
+            fatal();
+        }
+        // Skip what was written.
+        while( count && size_t(rc) >= v->iov_len ) {
+            rc -= v->iov_len;
+            ++v;
+            --count;
+        }
+        if( count ) {
+            v->iov_base = static_cast<char*>(v->iov_base) + rc;
+            v->iov_len -= rc;
+        }
+    }
+    if( ! iovecs.empty() )
+        waitedSeconds += (boost::posix_time::microsec_clock::universal_time() - start)
+            .total_microseconds() / 1e6;
+    iovecs.clear();
+    bufferUsed = 0;
+    while( ! texts.empty() ) {
+        release(texts.front());
+        texts.pop_front();
+    }
+}
+
+template class BasicOutput<FdSink>;
+template class BasicOutput<FileSink>;
+template class BasicOutput<GzipSink>;
+template class BasicOutput<NullSink>;
+
+void StringOutput::writeNumber(unsigned long long n)
+{
+    char s[24];
+    char* p = s + sizeof(s);
+    do {
+        *--p = '0' + n % 10;
+        n /= 10;
+    } while( n );
+    write(p, s + sizeof(s) - p);
+}
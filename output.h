@@ -0,0 +1,152 @@
+// (c) 2009, 2010 Alexander Holler
+// See the file COPYING for copying permission.
+//
+// Writes the stream for git fast-import to a file descriptor.
+//
+// Small parts (headers, commits) are collected in a buffer, texts are
+// taken over by the Output and only referenced. Everything is written
+// with writev(). If the file descriptor is a pipe to a reader known to
+// copy the data out of it (git fast-import started by us), large texts are
+// handed to the kernel with vmsplice() and not copied at all. In that case
+// a text is kept until enough pages have been spliced after it, that the
+// reader must have consumed it. Other readers (e.g. pv or tee) might
+// splice the pages onward, so they get everything by writev().
+//
+// The time spent waiting for the reader is measured.
+//
+// Where the data ends up is decided by the Sink, a policy given as
+// template parameter. The Sink is only used when the collected data is
+// written (not for every write()), and without any virtual call:
+// - FdSink writes to a file descriptor (a pipe to git fast-import or
+//   stdout), the only one supporting vmsplice(),
+// - FileSink writes into a file,
+// - GzipSink writes into a file compressed with zlib,
+// - NullSink throws everything away (to measure wp2git alone).
+//
+#ifndef WP2GIT_OUTPUT_H
+#define WP2GIT_OUTPUT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+
+#include <zlib.h>
+
+// A Sink has to offer the following. All return what writev() returns.
+class FdSink {
+    public:
+        typedef int Arg;
+        FdSink(int f) : fd(f) {}
+        ssize_t write(const struct iovec* v, int count) { return writev(fd, v, count); }
+        // The number of pages the pipe can hold, 0 if fd isn't a pipe.
+        size_t pipeSlots(void);
+        ssize_t splice(const struct iovec* v);
+    protected:
+        int fd;
+};
+
+class FileSink : public FdSink {
+    public:
+        typedef std::string Arg;
+        // Opens (and truncates) the file, exits on failure.
+        FileSink(const std::string& filename);
+        ~FileSink();
+        size_t pipeSlots(void) { return 0; }
+};
+
+class GzipSink {
+    public:
+        typedef std::string Arg;
+        GzipSink(const std::string& filename);
+        ~GzipSink();
+        ssize_t write(const struct iovec* v, int count);
+        size_t pipeSlots(void) { return 0; }
+        ssize_t splice(const struct iovec*) { return -1; }
+    private:
+        gzFile file;
+};
+
+class NullSink {
+    public:
+        typedef std::string Arg;
+        NullSink(const std::string&) {}
+        ssize_t write(const struct iovec* v, int count);
+        size_t pipeSlots(void) { return 0; }
+        ssize_t splice(const struct iovec*) { return -1; }
+};
+
+template<class Sink>
+class BasicOutput {
+    public:
+        // arg is given to the Sink (a file descriptor or a filename),
+        // name is used in error messages. Only with splice the texts
+        // might be given to a pipe with vmsplice().
+        BasicOutput(const typename Sink::Arg& arg, const std::string& name, bool splice = false);
+        ~BasicOutput();
+
+        // Copies the data into the buffer.
+        void write(const char* data, size_t len);
+        void write(const std::string& str) { write(str.data(), str.size()); }
+        void write(const char* str) { write(str, std::strlen(str)); }
+        void write(char c) { write(&c, 1); }
+        void writeNumber(unsigned long long n);
+        // Takes over the text (it will be empty afterwards).
+        void writeText(std::string& text);
+        // Writes everything collected.
+        void flush(void);
+
+        // Seconds spent waiting for the reader.
+        double waited(void) const { return waitedSeconds; }
+
+    private:
+        struct Spliced {
+            std::string text;
+            uint64_t releaseAt; // value of splicedPages
+        };
+        // Has to be checked before data is put into the buffer or texts.
+        bool full(void) const;
+        void add(const char* data, size_t len);
+        void splice(std::string& text);
+        void release(std::string& text);
+        void fatal(void);
+
+        Sink sink;
+        std::string name;
+        bool isPipe;
+        size_t pipeSlots; // number of pages a pipe can hold
+        uint64_t splicedPages;
+        double waitedSeconds;
+
+        std::vector<char> buffer;
+        size_t bufferUsed;
+        std::vector<struct iovec> iovecs;
+        std::deque<std::string> texts; // referenced by iovecs
+        std::deque<Spliced> spliced; // not yet consumed by the reader
+        std::vector<std::string> unused; // to reuse their memory
+};
+
+// Collects what would be written into a string, used to format data in
+// another thread than the one writing it. Offers what output_commit()
+// needs.
+class StringOutput {
+    public:
+        explicit StringOutput(std::string& s) : str(s) {}
+        void write(const char* data, size_t len) { str.append(data, len); }
+        void write(const std::string& s) { str += s; }
+        void write(const char* s) { str += s; }
+        void write(char c) { str += c; }
+        void writeNumber(unsigned long long n);
+    private:
+        std::string& str;
+};
+
+typedef BasicOutput<FdSink> Output;
+typedef BasicOutput<FileSink> FileOutput;
+typedef BasicOutput<GzipSink> GzipOutput;
+typedef BasicOutput<NullSink> NullOutput;
+
+#endif // WP2GIT_OUTPUT_H
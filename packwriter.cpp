@@ -0,0 +1,502 @@
+// (c) 2009, 2010 Alexander Holler
+// See the file COPYING for copying permission.
+//
+// The formats of packs, indices and deltas are described in
+// Documentation/technical/pack-format.txt of git.
+//
+#include "packwriter.h"
+
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <stdio.h> // rename()
+
+#include <zlib.h>
+
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include "sha1.h"
+
+// Longer delta chains are making reads slow.
+static const unsigned maxDepth(50);
+// Maximum number of objects waiting to be written.
+static const size_t maxQueued(4096);
+
+std::string PackWriter::Sha1::hex(void) const
+{
+    static const char hexChars[] = "0123456789abcdef";
+    std::string s(40, '0');
+    for( unsigned i = 0; i < 20; ++i ) {
+        s[i*2] = hexChars[hash[i] >> 4];
+        s[i*2+1] = hexChars[hash[i] & 0x0f];
+    }
+    return s;
+}
+
+bool PackWriter::Sha1::operator<(const Sha1& s) const
+{
+    return std::memcmp(hash, s.hash, 20) < 0;
+}
+
+PackWriter::Sha1 PackWriter::hash(Type type, const std::string& data)
+{
+    static const char* names[] = { "", "commit ", "tree ", "blob " };
+    std::string header(names[type]);
+    header += boost::lexical_cast<std::string>(data.size());
+    Sha1Hash h;
+    h.process(header.c_str(), header.size() + 1); // including the '\0'
+    h.process(data.data(), data.size());
+    Sha1 sha1;
+    h.digest(sha1.hash);
+    return sha1;
+}
+
+// Deltas
+
+static void putSize(std::string& out, size_t size)
+{
+    do {
+        unsigned char c = size & 0x7f;
+        size >>= 7;
+        if( size )
+            c |= 0x80;
+        out += c;
+    } while( size );
+}
+
+static void putInsert(std::string& out, const char* data, size_t len)
+{
+    while( len ) {
+        size_t n = std::min(len, size_t(0x7f));
+        out += char(n);
+        out.append(data, n);
+        data += n;
+        len -= n;
+    }
+}
+
+static void putCopy(std::string& out, size_t offset, size_t len)
+{
+    while( len ) {
+        size_t n = std::min(len, size_t(0x10000));
+        std::string::size_type cmd = out.size();
+        unsigned char c = 0x80;
+        out += '\0';
+        for( unsigned i = 0; i < 4; ++i )
+            if( (offset >> (i*8)) & 0xff ) {
+                c |= 1 << i;
+                out += char(offset >> (i*8));
+            }
+        // A size of 0x10000 is encoded as 0.
+        if( n != 0x10000 )
+            for( unsigned i = 0; i < 3; ++i )
+                if( (n >> (i*8)) & 0xff ) {
+                    c |= 0x10 << i;
+                    out += char(n >> (i*8));
+                }
+        out[cmd] = c;
+        offset += n;
+        len -= n;
+    }
+}
+
+// Blocks of the source are found through a rolling hash over this many bytes.
+static const size_t deltaBlock(16);
+static const uint32_t deltaMul(0x01000193);
+
+static uint32_t blockHash(const unsigned char* p)
+{
+    uint32_t h(0);
+    for( size_t i = 0; i < deltaBlock; ++i )
+        h = h * deltaMul + p[i];
+    return h;
+}
+
+// Creates a delta which builds dst out of src.
+static void makeDelta(const std::string& src, const std::string& dst, std::string& out)
+{
+    out.clear();
+    putSize(out, src.size());
+    putSize(out, dst.size());
+    const unsigned char* s = reinterpret_cast<const unsigned char*>(src.data());
+    const unsigned char* d = reinterpret_cast<const unsigned char*>(dst.data());
+
+    unsigned bits(8);
+    while( (size_t(1) << bits) < src.size() / deltaBlock * 2 )
+        ++bits;
+    // Stores position + 1 of a block in src, 0 = none.
+    std::vector<uint32_t> table(size_t(1) << bits);
+    for( size_t i = 0; i + deltaBlock <= src.size(); i += deltaBlock )
+        table[(blockHash(s+i) * 0x9E3779B1u) >> (32 - bits)] = i + 1;
+
+    // deltaMul^(deltaBlock-1), to remove the oldest byte from the hash.
+    uint32_t outFactor(1);
+    for( size_t i = 1; i < deltaBlock; ++i )
+        outFactor *= deltaMul;
+
+    size_t literal(0); // start of not yet written bytes in dst
+    size_t i(0);
+    uint32_t h(dst.size() >= deltaBlock ? blockHash(d) : 0);
+    while( i + deltaBlock <= dst.size() ) {
+        uint32_t cand = table[(h * 0x9E3779B1u) >> (32 - bits)];
+        if( cand && ! std::memcmp(s+cand-1, d+i, deltaBlock) ) {
+            size_t from = cand - 1;
+            size_t len = deltaBlock;
+            while( from + len < src.size() && i + len < dst.size() && s[from+len] == d[i+len] )
+                ++len;
+            while( from && i > literal && s[from-1] == d[i-1] ) {
+                --from;
+                --i;
+                ++len;
+            }
+            putInsert(out, dst.data() + literal, i - literal);
+            putCopy(out, from, len);
+            i += len;
+            literal = i;
+            if( i + deltaBlock <= dst.size() )
+                h = blockHash(d+i);
+            continue;
+        }
+        if( i + deltaBlock < dst.size() )
+            h = (h - d[i] * outFactor) * deltaMul + d[i+deltaBlock];
+        ++i;
+    }
+    putInsert(out, dst.data() + literal, dst.size() - literal);
+}
+
+// PackWriter
+
+PackWriter::PackWriter(const std::string& dir, unsigned threadCount)
+    : gitdir(dir)
+    , tmpname(dir + "/objects/pack/tmp_pack_wp2git")
+    , offset(12)
+    , deltaCount(0)
+    , objectCount(0)
+    , added(0)
+    , stopping(false)
+{
+    file = std::fopen(tmpname.c_str(), "w+b");
+    if( ! file )
+        fatal("Can't open file '" + tmpname + "'! Is '" + gitdir + "' a git directory?");
+    // The number of objects will be fixed in finish().
+    static const char header[12] = { 'P', 'A', 'C', 'K', 0, 0, 0, 2, 0, 0, 0, 0 };
+    if( std::fwrite(header, sizeof(header), 1, file) != 1 )
+        fatal("Can't write to file '" + tmpname + "'!");
+    if( ! threadCount )
+        threadCount = std::max(1u, boost::thread::hardware_concurrency());
+    for( unsigned i = 0; i < threadCount; ++i )
+        threads.create_thread(boost::bind(&PackWriter::worker, this));
+    writerThread = boost::thread(boost::bind(&PackWriter::writer, this));
+}
+
+PackWriter::~PackWriter()
+{
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        stopping = true;
+    }
+    cond.notify_all();
+    threads.join_all();
+    if( writerThread.joinable() )
+        writerThread.join();
+    if( file )
+        std::fclose(file);
+}
+
+void PackWriter::fatal(const std::string& what)
+{
+    std::cerr << "ERROR: " << what << std::endl;
+    exit(5);
+}
+
+size_t PackWriter::add(Type type, const Data& data, Base* base, const Sha1* sha1)
+{
+    Job* job = new Job;
+    job->type = type;
+    job->data = data;
+    job->baseIndex = 0;
+    job->hashed = sha1;
+    job->done = false;
+    job->isDelta = false;
+    if( sha1 )
+        job->sha1 = *sha1;
+    if( base && base->index && base->depth < maxDepth ) {
+        job->base = base->data;
+        job->baseIndex = base->index;
+    }
+    size_t index;
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        while( queue.size() >= maxQueued )
+            cond.wait(lock);
+        queue.push_back(job);
+        todo.push_back(job);
+        index = ++added;
+    }
+    cond.notify_all();
+    if( base ) {
+        base->depth = job->baseIndex ? base->depth + 1 : 0;
+        base->index = index;
+        base->data = data;
+    }
+    return index;
+}
+
+PackWriter::Sha1 PackWriter::sha1(size_t index)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    while( entries.size() < index )
+        cond.wait(lock);
+    return entries[index-1].sha1;
+}
+
+void PackWriter::worker(void)
+{
+    for(;;) {
+        Job* job;
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            while( todo.empty() && ! stopping )
+                cond.wait(lock);
+            if( todo.empty() )
+                return;
+            job = todo.front();
+            todo.pop_front();
+        }
+        process(*job);
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            job->done = true;
+        }
+        cond.notify_all();
+    }
+}
+
+void PackWriter::process(Job& job)
+{
+    if( ! job.hashed )
+        job.sha1 = hash(job.type, *job.data);
+    const std::string* payload = job.data.get();
+    std::string delta;
+    if( job.base ) {
+        makeDelta(*job.base, *job.data, delta);
+        // Not worth it, store the object as is.
+        if( delta.size() < job.data->size() / 2 ) {
+            payload = &delta;
+            job.isDelta = true;
+        }
+        job.base.reset();
+    }
+    job.size = payload->size();
+    uLongf len = compressBound(payload->size());
+    job.packed.resize(len);
+    if( compress2(reinterpret_cast<Bytef*>(&job.packed[0]), &len,
+            reinterpret_cast<const Bytef*>(payload->data()), payload->size(),
+            Z_DEFAULT_COMPRESSION) != Z_OK )
+        fatal("zlib failed to compress an object!");
+    job.packed.resize(len);
+    job.data.reset();
+}
+
+void PackWriter::writer(void)
+{
+    for(;;) {
+        Job* job;
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            while( (queue.empty() || ! queue.front()->done) && ! (stopping && queue.empty()) )
+                cond.wait(lock);
+            if( queue.empty() )
+                return;
+            job = queue.front();
+        }
+        write(*job);
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            queue.pop_front();
+        }
+        cond.notify_all();
+        delete job;
+    }
+}
+
+void PackWriter::write(const Job& job)
+{
+    // The header: type and size, followed by the (negative) offset of the
+    // base for deltas.
+    unsigned char header[32];
+    size_t hlen(0);
+    size_t size = job.size;
+    unsigned char c = ((job.isDelta ? 6 : job.type) << 4) | (size & 0x0f);
+    size >>= 4;
+    while( size ) {
+        header[hlen++] = c | 0x80;
+        c = size & 0x7f;
+        size >>= 7;
+    }
+    header[hlen++] = c;
+    if( job.isDelta ) {
+        uint64_t ofs;
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            ofs = offset - entries[job.baseIndex-1].offset;
+        }
+        unsigned char dheader[10];
+        unsigned pos = sizeof(dheader) - 1;
+        dheader[pos] = ofs & 0x7f;
+        while( ofs >>= 7 )
+            dheader[--pos] = 0x80 | (--ofs & 0x7f);
+        std::memcpy(header + hlen, dheader + pos, sizeof(dheader) - pos);
+        hlen += sizeof(dheader) - pos;
+        ++deltaCount;
+    }
+    if( std::fwrite(header, hlen, 1, file) != 1
+            || std::fwrite(job.packed.data(), job.packed.size(), 1, file) != 1 )
+        fatal("Can't write to file '" + tmpname + "'!");
+    Entry e;
+    e.sha1 = job.sha1;
+    e.offset = offset;
+    e.crc = crc32(crc32(0, header, hlen),
+        reinterpret_cast<const Bytef*>(job.packed.data()), job.packed.size());
+    offset += hlen + job.packed.size();
+    ++objectCount;
+    boost::mutex::scoped_lock lock(mutex);
+    entries.push_back(e);
+}
+
+static void put32(std::string& s, uint32_t v)
+{
+    s += char(v >> 24);
+    s += char(v >> 16);
+    s += char(v >> 8);
+    s += char(v);
+}
+
+void PackWriter::finish(const std::string& ref, const std::string& head)
+{
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        stopping = true;
+    }
+    cond.notify_all();
+    threads.join_all();
+    writerThread.join();
+
+    // Fix the number of objects in the header and hash the whole pack.
+    std::string count;
+    put32(count, objectCount);
+    std::vector<char> buffer(1024*1024);
+    Sha1Hash h;
+    if( std::fseek(file, 8, SEEK_SET)
+            || std::fwrite(count.data(), 4, 1, file) != 1
+            || std::fflush(file)
+            || std::fseek(file, 0, SEEK_SET) )
+        fatal("Can't write to file '" + tmpname + "'!");
+    size_t len;
+    while( (len = std::fread(&buffer[0], 1, buffer.size(), file)) > 0 )
+        h.process(&buffer[0], len);
+    Sha1 packSha1;
+    h.digest(packSha1.hash);
+    if( std::fseek(file, 0, SEEK_END)
+            || std::fwrite(packSha1.hash, 20, 1, file) != 1
+            || std::fclose(file) )
+        fatal("Can't write to file '" + tmpname + "'!");
+    file = NULL;
+
+    std::string name(gitdir + "/objects/pack/pack-" + packSha1.hex());
+    writeIndex(name + ".idx", packSha1);
+    if( std::rename(tmpname.c_str(), (name + ".pack").c_str()) )
+        fatal("Can't rename '" + tmpname + "'!");
+
+    std::ofstream r((gitdir + '/' + ref).c_str());
+    r << head << '\n';
+    if( ! r )
+        fatal("Can't write '" + gitdir + '/' + ref + "'!");
+}
+
+void PackWriter::writeIndex(const std::string& name, const Sha1& packSha1)
+{
+    std::sort(entries.begin(), entries.end());
+    // Version 2: magic, version, fanout, hashes, crcs, offsets, large offsets.
+    std::string idx("\377tOc");
+    put32(idx, 2);
+    size_t n(0);
+    for( unsigned i = 0; i < 256; ++i ) {
+        while( n < entries.size() && entries[n].sha1.hash[0] == i )
+            ++n;
+        put32(idx, n);
+    }
+    idx.reserve(idx.size() + entries.size() * 28 + 40);
+    for( size_t i = 0; i < entries.size(); ++i )
+        idx.append(reinterpret_cast<const char*>(entries[i].sha1.hash), 20);
+    for( size_t i = 0; i < entries.size(); ++i )
+        put32(idx, entries[i].crc);
+    std::string large;
+    for( size_t i = 0; i < entries.size(); ++i ) {
+        if( entries[i].offset < 0x80000000 )
+            put32(idx, entries[i].offset);
+        else {
+            put32(idx, 0x80000000 | (large.size() / 8));
+            put32(large, entries[i].offset >> 32);
+            put32(large, entries[i].offset);
+        }
+    }
+    idx += large;
+    idx.append(reinterpret_cast<const char*>(packSha1.hash), 20);
+    Sha1 idxSha1;
+    sha1Digest(idx.data(), idx.size(), idxSha1.hash);
+    idx.append(reinterpret_cast<const char*>(idxSha1.hash), 20);
+
+    std::ofstream f(name.c_str(), std::ios_base::out | std::ios_base::binary);
+    f.write(idx.data(), idx.size());
+    if( ! f )
+        fatal("Can't write file '" + name + "'!");
+}
+
+// TreeWriter
+
+void TreeWriter::set(const std::string& path, const PackWriter::Sha1& blob)
+{
+    Node* node = root.get();
+    node->dirty = true;
+    size_t start(0), slash;
+    while( (slash = path.find('/', start)) != std::string::npos ) {
+        Entry& e = node->entries[path.substr(start, slash - start + 1)];
+        if( ! e.dir )
+            e.dir.reset(new Node);
+        node = e.dir.get();
+        node->dirty = true;
+        start = slash + 1;
+    }
+    node->entries[path.substr(start)].sha1 = blob;
+}
+
+PackWriter::Sha1 TreeWriter::write(Node& node)
+{
+    boost::shared_ptr<std::string> data(new std::string);
+    for( Entries::iterator i = node.entries.begin(); i != node.entries.end(); ++i ) {
+        if( i->second.dir ) {
+            if( i->second.dir->dirty )
+                i->second.sha1 = write(*i->second.dir);
+            *data += "40000 ";
+            data->append(i->first, 0, i->first.size() - 1);
+        }
+        else {
+            *data += "100644 ";
+            *data += i->first;
+        }
+        *data += '\0';
+        data->append(reinterpret_cast<const char*>(i->second.sha1.hash), 20);
+    }
+    node.dirty = false;
+    PackWriter::Sha1 sha1(PackWriter::hash(PackWriter::Type_tree, *data));
+    DigestTable::Digest digest;
+    std::memcpy(digest, sha1.hash, sizeof(digest));
+    if( written.find(digest) )
+        return sha1;
+    written.insert(digest, pack.add(PackWriter::Type_tree, data, &node.base, &sha1));
+    return sha1;
+}
@@ -0,0 +1,159 @@
+// (c) 2009, 2010 Alexander Holler
+// See the file COPYING for copying permission.
+//
+// Writes git objects directly into a pack (and its index), without
+// the need for git fast-import and a git gc afterwards.
+//
+// Objects are deltified against a base given by the caller (usually the
+// previous revision of the same page or the previous version of the same
+// tree). Hashing, deltifying and compressing is done on a pool of threads,
+// a writer thread appends the results in the order they were added.
+//
+#ifndef WP2GIT_PACKWRITER_H
+#define WP2GIT_PACKWRITER_H
+
+#include <stdint.h>
+#include <cstdio>
+#include <string>
+#include <deque>
+#include <vector>
+#include <map>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "digesttable.h"
+
+class PackWriter {
+    public:
+        enum Type {
+            Type_commit = 1,
+            Type_tree = 2,
+            Type_blob = 3,
+        };
+
+        struct Sha1 {
+            unsigned char hash[20];
+            std::string hex(void) const;
+            bool operator<(const Sha1& s) const;
+        };
+
+        typedef boost::shared_ptr<const std::string> Data;
+
+        // The last object added for something (e.g. a page or a directory),
+        // used as delta base for the next one.
+        struct Base {
+            Base() : index(0), depth(0) {}
+            size_t index; // 0 = none
+            unsigned depth;
+            Data data;
+        };
+
+        // threads = 0 uses the number of cpus.
+        PackWriter(const std::string& gitdir, unsigned threads = 0);
+        ~PackWriter();
+
+        // Adds an object and returns its index (starting with 1).
+        // If base is given, the object might be stored as delta against it
+        // and base will be updated to the new object afterwards.
+        // If the hash is already known, it can be given as sha1, otherwise
+        // it will be calculated by the thread pool and is available through
+        // sha1() later.
+        size_t add(Type type, const Data& data, Base* base = NULL, const Sha1* sha1 = NULL);
+
+        // Returns the hash of an object (waits until it is written).
+        Sha1 sha1(size_t index);
+
+        // Writes the trailer of the pack, the index and sets ref to head
+        // (given as hex).
+        void finish(const std::string& ref, const std::string& head);
+
+        uint64_t deltas(void) const { return deltaCount; }
+        uint64_t objects(void) const { return objectCount; }
+
+        static Sha1 hash(Type type, const std::string& data);
+
+    private:
+        struct Job {
+            Type type;
+            Data data;
+            Data base;
+            size_t baseIndex;
+            bool hashed;
+            bool done;
+            bool isDelta;
+            size_t size; // uncompressed size of what is stored
+            Sha1 sha1;
+            std::string packed;
+        };
+        struct Entry {
+            Sha1 sha1;
+            uint32_t crc;
+            uint64_t offset;
+            bool operator<(const Entry& e) const { return sha1 < e.sha1; }
+        };
+
+        void worker(void);
+        void writer(void);
+        void process(Job& job);
+        void write(const Job& job);
+        void writeIndex(const std::string& name, const Sha1& packSha1);
+        void fatal(const std::string& what);
+
+        std::string gitdir;
+        std::string tmpname;
+        std::FILE* file;
+        uint64_t offset;
+        uint64_t deltaCount;
+        uint64_t objectCount;
+        size_t added;
+
+        std::vector<Entry> entries;
+
+        boost::mutex mutex;
+        boost::condition_variable cond;
+        std::deque<Job*> todo; // not processed by a worker
+        std::deque<Job*> queue; // not written, in order
+        bool stopping;
+        boost::thread_group threads;
+        boost::thread writerThread;
+};
+
+// Keeps the directory structure of the HEAD in memory and writes the
+// trees which were changed since the last call of write().
+class TreeWriter {
+    public:
+        TreeWriter(PackWriter& p)
+            : pack(p)
+            , root(new Node)
+            {}
+        void set(const std::string& path, const PackWriter::Sha1& blob);
+        // Returns the hash of the root tree.
+        PackWriter::Sha1 write(void) { return write(*root); }
+
+    private:
+        struct Node;
+        struct Entry {
+            PackWriter::Sha1 sha1;
+            boost::shared_ptr<Node> dir; // empty for files
+        };
+        // Directories are stored with a trailing '/', which makes the map
+        // use the same order git does.
+        typedef std::map<std::string, Entry> Entries;
+        struct Node {
+            Node() : dirty(true) {}
+            Entries entries;
+            bool dirty;
+            PackWriter::Base base;
+        };
+        PackWriter::Sha1 write(Node& node);
+
+        PackWriter& pack;
+        boost::shared_ptr<Node> root;
+        // All trees written, reverts are producing trees we already have.
+        DigestTable written;
+};
+
+#endif // WP2GIT_PACKWRITER_H
@@ -0,0 +1,40 @@
+#!/bin/sh
+#
+# (c) 2009, 2010 Alexander Holler
+# See the file COPYING for copying permission.
+#
+# Builds a profile guided optimized (and link time optimized) wp2git:
+# An instrumented wp2git is trained with a dump and then built again
+# using the profiles.
+#
+# usage: pgo.sh [builddir [dump]]
+# Without a dump, one is generated with wp2git-gen. The training output
+# is thrown away, only the profiles are kept.
+
+src=$(cd $(dirname $0) && pwd)
+build=${1:-build-pgo}
+dump=$2
+case "$dump" in
+    ""|/*) ;;
+    *) dump=$(pwd)/$dump ;;
+esac
+
+mkdir -p $build || exit 1
+cd $build || exit 1
+rm -rf pgo
+
+cmake -DCMAKE_BUILD_TYPE=release -DWP2GIT_PGO=generate $src || exit 1
+make clean && make wp2git wp2git-gen || exit 1
+if [ -z "$dump" ]; then
+    dump=pgo-training.xml.bz2
+    ./wp2git-gen -p 3000 -r 10 -s 3000 --skew 3600 -o $dump || exit 1
+fi
+# Train step 1 and step 2, with dedup and the pack writer.
+./wp2git --report-interval 0 $dump >/dev/null || exit 1
+rm -rf pgo-repo && git init -q pgo-repo || exit 1
+./wp2git --report-interval 0 -p pgo-repo/.git $dump || exit 1
+rm -rf pgo-repo
+
+cmake -DWP2GIT_PGO=use $src || exit 1
+make clean && make wp2git || exit 1
+echo "Built $build/wp2git using the profiles in $build/pgo."
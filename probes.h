@@ -0,0 +1,27 @@
+// (c) 2009, 2010 Alexander Holler
+// See the file COPYING for copying permission.
+//
+// Static tracepoints (USDT) for perf, bpftrace or systemtap, e.g.
+//   bpftrace -e 'usdt:./wp2git:wp2git:revision { @[arg1 >> 10] = count(); }'
+// A probe is only a nop as long as nobody is attached. Without
+// sys/sdt.h (from systemtap) the probes are left out.
+//
+// The probes (and their arguments) are:
+//   page_start(title), page_end(title, revisions),
+//   revision(id, text size), blob(mark, size), commit(revision id),
+//   tempfile_write(position, size), tempfile_read(position, size),
+//   parse_start(size), parse_end(size).
+//
+#ifndef WP2GIT_PROBES_H
+#define WP2GIT_PROBES_H
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define PROBE1(name, a) DTRACE_PROBE1(wp2git, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(wp2git, name, a, b)
+#else
+#define PROBE1(name, a) do {} while(0)
+#define PROBE2(name, a, b) do {} while(0)
+#endif
+
+#endif // WP2GIT_PROBES_H
@@ -0,0 +1,137 @@
+// (c) 2009, 2010 Alexander Holler
+// See the file COPYING for copying permission.
+
+#include <signal.h>
+#include <iostream>
+#include <sstream>
+
+#include <boost/bind.hpp>
+
+#include "reporter.h"
+#include "meminfo.h"
+
+static volatile sig_atomic_t reportNow(0);
+
+static void sigusr1(int)
+{
+    reportNow = 1;
+}
+
+static boost::posix_time::ptime now(void)
+{
+    return boost::posix_time::microsec_clock::local_time();
+}
+
+Reporter::Reporter(unsigned i, uint64_t s, uint64_t r)
+    : interval(i)
+    , size(s)
+    , revisionsTotal(r)
+    , step(1)
+    , commits(0)
+    , commitsTotal(0)
+    , start(now())
+    , last(start)
+    , lastCommits(0)
+    , stopping(false)
+{
+    struct sigaction sa;
+    sa.sa_handler = sigusr1;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+    thread = boost::thread(boost::bind(&Reporter::run, this));
+}
+
+Reporter::~Reporter()
+{
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        stopping = true;
+    }
+    thread.join();
+}
+
+void Reporter::read(const Read& r)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    current = r;
+}
+
+void Reporter::writing(uint64_t c)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    step = 2;
+    commitsTotal = c;
+    start = last = ::now();
+}
+
+void Reporter::written(void)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    ++commits;
+}
+
+void Reporter::run(void)
+{
+    // We are sleeping in small slices to react on SIGUSR1 and the end.
+    boost::posix_time::ptime next(::now() + boost::posix_time::seconds(interval));
+    for(;;) {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            if( stopping )
+                return;
+        }
+        if( reportNow || (interval && ::now() >= next) ) {
+            reportNow = 0;
+            report();
+            next = ::now() + boost::posix_time::seconds(interval);
+        }
+    }
+}
+
+static std::string perSecond(uint64_t n, double seconds)
+{
+    std::ostringstream s;
+    s.precision(1);
+    s << std::fixed << (seconds > 0 ? n / seconds : 0.0) << "/s";
+    return s.str();
+}
+
+void Reporter::report(void)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    boost::posix_time::ptime t(::now());
+    double seconds = (t - last).total_milliseconds() / 1000.0;
+    // Done as fraction of the whole step.
+    double done(0);
+    std::ostringstream s;
+    s.precision(1);
+    s << std::fixed;
+    if( step == 1 ) {
+        s << "Read " << current.pages << " pages (" << perSecond(current.pages - lastRead.pages, seconds)
+            << "), " << current.revisions << " revisions ("
+            << perSecond(current.revisions - lastRead.revisions, seconds) << "), "
+            << (current.bytes >> 20) << " MB ("
+            << (seconds > 0 ? (current.bytes - lastRead.bytes) / seconds / (1 << 20) : 0.0) << " MB/s)";
+        if( size )
+            done = double(current.position) / size;
+        else if( revisionsTotal )
+            done = double(current.revisions) / revisionsTotal;
+        lastRead = current;
+    }
+    else {
+        s << "Wrote " << commits << '/' << commitsTotal << " commits ("
+            << perSecond(commits - lastCommits, seconds) << ')';
+        if( commitsTotal )
+            done = double(commits) / commitsTotal;
+        lastCommits = commits;
+    }
+    s << ", RSS " << (rssBytes() >> 20) << " MB";
+    if( done > 0 && done <= 1 )
+        s << ", " << done * 100 << "% (ETA step " << step << ": "
+            << boost::posix_time::to_simple_string(boost::posix_time::seconds(
+                long((t - start).total_milliseconds() / 1000.0 * (1 - done) / done))) << ')';
+    last = t;
+    std::cerr << s.str() << std::endl;
+}
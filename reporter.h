@@ -0,0 +1,61 @@
+// (c) 2009, 2010 Alexander Holler
+// See the file COPYING for copying permission.
+//
+// Prints the progress to stderr from a thread of its own, every interval
+// seconds and whenever a SIGUSR1 is received. The main loop only updates
+// some counters, which is much cheaper than printing a line per page.
+//
+#ifndef WP2GIT_REPORTER_H
+#define WP2GIT_REPORTER_H
+
+#include <stdint.h>
+#include <string>
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+class Reporter {
+    public:
+        // What step 1 has done.
+        struct Read {
+            Read() : pages(0), revisions(0), bytes(0), position(0) {}
+            uint64_t pages;
+            uint64_t revisions;
+            uint64_t bytes; // uncompressed
+            uint64_t position; // in the (compressed) input
+        };
+
+        // interval = 0 reports only on SIGUSR1.
+        // size is the size of the (compressed) input (0 if unknown),
+        // revisions the number of revisions expected (0 if unknown).
+        Reporter(unsigned interval, uint64_t size, uint64_t revisions);
+        ~Reporter();
+
+        void read(const Read& r);
+        // Starts step 2.
+        void writing(uint64_t commits);
+        void written(void);
+
+    private:
+        void run(void);
+        void report(void);
+
+        unsigned interval;
+        uint64_t size;
+        uint64_t revisionsTotal;
+        boost::mutex mutex;
+        unsigned step;
+        Read current;
+        uint64_t commits;
+        uint64_t commitsTotal;
+        // At the start of the step and the last report.
+        boost::posix_time::ptime start;
+        boost::posix_time::ptime last;
+        Read lastRead;
+        uint64_t lastCommits;
+        bool stopping;
+        boost::thread thread;
+};
+
+#endif // WP2GIT_REPORTER_H
@@ -0,0 +1,50 @@
+// (c) 2009, 2010 Alexander Holler
+// See the file COPYING for copying permission.
+//
+// SHA-1 (using boost) with the digest as 20 bytes, in the order git shows
+// them. boost::uuids::detail::sha1::digest_type was unsigned int[5] (the
+// words of the digest) and is unsigned char[20] since boost 1.86, so
+// nothing else should use it.
+//
+#ifndef WP2GIT_SHA1_H
+#define WP2GIT_SHA1_H
+
+#include <cstddef>
+#include <cstring>
+
+#include <boost/uuid/detail/sha1.hpp>
+
+class Sha1Hash {
+    public:
+        void process(const void* data, std::size_t len) { h.process_bytes(data, len); }
+        // Has to be called only once, after everything was processed.
+        void digest(unsigned char bytes[20]) {
+            boost::uuids::detail::sha1::digest_type d;
+            h.get_digest(d);
+            toBytes(d, bytes);
+        }
+    private:
+        // The one matching digest_type is used.
+        static void toBytes(const unsigned int (&words)[5], unsigned char* bytes) {
+            for( unsigned i = 0; i < 5; ++i ) {
+                bytes[i*4] = words[i] >> 24;
+                bytes[i*4+1] = words[i] >> 16;
+                bytes[i*4+2] = words[i] >> 8;
+                bytes[i*4+3] = words[i];
+            }
+        }
+        static void toBytes(const unsigned char (&d)[20], unsigned char* bytes) {
+            std::memcpy(bytes, d, 20);
+        }
+        boost::uuids::detail::sha1 h;
+};
+
+// The SHA-1 of data as 20 bytes.
+inline void sha1Digest(const void* data, std::size_t len, unsigned char bytes[20])
+{
+    Sha1Hash h;
+    h.process(data, len);
+    h.digest(bytes);
+}
+
+#endif // WP2GIT_SHA1_H
@@ -0,0 +1,309 @@
+// (c) 2009, 2010 Alexander Holler
+// See the file COPYING for copying permission.
+//
+// Writes a synthetic MediaWiki export (pages-meta-history), to measure
+// wp2git without the need for a real dump.
+//
+// The texts are made of random words, every revision either changes
+// some part of the previous text, reverts to an older one or replaces
+// the whole text.
+//
+
+#include <stdint.h>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/filter/bzip2.hpp>
+#include <boost/iostreams/device/file_descriptor.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <boost/program_options/variables_map.hpp>
+#include <boost/program_options/options_description.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+#include <boost/random/uniform_real_distribution.hpp>
+#include <boost/random/lognormal_distribution.hpp>
+
+#include "sha1.h"
+
+// Options.
+static std::string outputname;
+static bool bz2(false);
+static unsigned long pages(1000);
+static unsigned revisions(10);
+static unsigned long text_size(5000);
+static double text_sigma(1.0);
+static std::string namespaces("Talk,User,Wikipedia");
+static double ns_ratio(0.3);
+static unsigned long skew(0);
+static bool no_sha1(false);
+static unsigned seed(1);
+
+static boost::random::mt19937 rng;
+
+static int config(int argc, char** argv)
+{
+    boost::program_options::options_description desc("Allowed options");
+    desc.add_options()
+        ("help,h", "Produce help message")
+        ("output,o", boost::program_options::value<std::string>(&outputname),
+            "The file to write (default stdout)")
+        ("bz2,j", boost::program_options::bool_switch(&bz2),
+            "Compress the output with bzip2 (default if the output ends with .bz2)")
+        ("pages,p", boost::program_options::value<unsigned long>(&pages),
+            "The number of pages (default 1000)")
+        ("revisions,r", boost::program_options::value<unsigned>(&revisions),
+            "The mean number of revisions per page (default 10)")
+        ("text-size,s", boost::program_options::value<unsigned long>(&text_size),
+            "The median size of a text in bytes (default 5000)")
+        ("text-sigma", boost::program_options::value<double>(&text_sigma),
+            "The sigma of the lognormal distribution of the text sizes (default 1.0)")
+        ("namespaces,n", boost::program_options::value<std::string>(&namespaces),
+            "Comma separated names of the namespaces besides the main one (default Talk,User,Wikipedia)")
+        ("ns-ratio", boost::program_options::value<double>(&ns_ratio),
+            "The part of the pages which are not in the main namespace (default 0.3)")
+        ("skew", boost::program_options::value<unsigned long>(&skew),
+            "Move every timestamp randomly by up to this many seconds, which lets revisions of a page get out of order (default 0)")
+        ("no-sha1", boost::program_options::bool_switch(&no_sha1),
+            "Don't write the SHA-1 of the texts (like older dumps)")
+        ("seed", boost::program_options::value<unsigned>(&seed),
+            "The seed for the random numbers (default 1)")
+    ;
+    boost::program_options::variables_map vm;
+    try {
+        boost::program_options::store(boost::program_options::parse_command_line(argc, argv, desc), vm);
+        boost::program_options::notify(vm);
+    }
+    catch (std::exception& e) {
+        std::cerr << desc << std::endl;
+        return 1;
+    }
+    if( vm.count("help") || ! revisions ) {
+        std::cerr << "Usage:" << std::endl << std::endl;
+        std::cerr << argv[0] << " [options] | wp2git | GIT_DIR=repo git fast-import" << std::endl;
+        std::cerr << std::endl << desc << std::endl;
+        return 1;
+    }
+    if( outputname.size() > 4 && ! outputname.compare(outputname.size()-4, 4, ".bz2") )
+        bz2 = true;
+    rng.seed(seed);
+    return 0;
+}
+
+static unsigned long randomInt(unsigned long min, unsigned long max)
+{
+    return boost::random::uniform_int_distribution<unsigned long>(min, max)(rng);
+}
+
+static double randomReal(void)
+{
+    return boost::random::uniform_real_distribution<double>(0, 1)(rng);
+}
+
+static std::vector<std::string> words;
+
+static void makeWords(void)
+{
+    for( unsigned i = 0; i < 5000; ++i ) {
+        std::string w;
+        for( unsigned long l = randomInt(1, 10); l; --l )
+            w += char('a' + randomInt(0, 25));
+        words.push_back(w);
+    }
+    // Some words which have to be escaped.
+    words.push_back("&amp;");
+    words.push_back("<ref>");
+    words.push_back("\"quoted\"");
+}
+
+// Random words, about size bytes.
+static std::string makeText(unsigned long size)
+{
+    std::string t;
+    while( t.size() < size ) {
+        t += words[randomInt(0, words.size()-1)];
+        t += randomReal() < 0.05 ? '\n' : ' ';
+    }
+    return t;
+}
+
+static std::string escape(const std::string& s)
+{
+    std::string r;
+    r.reserve(s.size() + s.size() / 16);
+    for( size_t i = 0; i < s.size(); ++i )
+        switch( s[i] ) {
+            case '&': r += "&amp;"; break;
+            case '<': r += "&lt;"; break;
+            case '>': r += "&gt;"; break;
+            case '"': r += "&quot;"; break;
+            default: r += s[i];
+        }
+    return r;
+}
+
+// The SHA-1 as base 36, like MediaWiki writes it.
+static std::string base36Sha1(const std::string& text)
+{
+    unsigned char d[20];
+    sha1Digest(text.data(), text.size(), d);
+    std::string r(31, '0');
+    // d[0] is the most significant byte.
+    for( size_t pos = r.size(); pos--; ) {
+        unsigned rest(0);
+        for( int b = 0; b < 20; ++b ) {
+            rest = (rest << 8) | d[b];
+            d[b] = (unsigned char)(rest / 36);
+            rest %= 36;
+        }
+        r[pos] = "0123456789abcdefghijklmnopqrstuvwxyz"[rest];
+    }
+    return r;
+}
+
+static std::string timestamp(std::time_t t)
+{
+    char buf[32];
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", &tm);
+    return buf;
+}
+
+int main(int argc, char** argv)
+{
+    if( config(argc, argv) )
+        return 3;
+
+    std::ofstream file;
+    boost::iostreams::filtering_ostream out;
+    if( bz2 )
+        out.push(boost::iostreams::bzip2_compressor());
+    if( outputname.empty() )
+        out.push(boost::iostreams::file_descriptor_sink(1, boost::iostreams::never_close_handle));
+    else {
+        file.open(outputname.c_str(), std::ios_base::out | std::ios_base::binary);
+        if( ! file ) {
+            std::cerr << "ERROR: Can't open file '" << outputname << "'!" << std::endl;
+            return 2;
+        }
+        out.push(file);
+    }
+
+    std::vector<std::string> ns;
+    boost::algorithm::split(ns, namespaces, boost::algorithm::is_any_of(","));
+    if( ns.size() == 1 && ns[0].empty() )
+        ns.clear();
+
+    makeWords();
+    boost::random::lognormal_distribution<double> sizes(std::log(double(text_size)), text_sigma);
+
+    out << "<mediawiki xmlns=\"http://www.mediawiki.org/xml/export-0.10/\" "
+        "xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\" "
+        "xsi:schemaLocation=\"http://www.mediawiki.org/xml/export-0.10/ "
+        "http://www.mediawiki.org/xml/export-0.10.xsd\" version=\"0.10\" xml:lang=\"en\">\n"
+        "  <siteinfo>\n"
+        "    <sitename>Wp2gitgen</sitename>\n"
+        "    <dbname>wp2gitgenwiki</dbname>\n"
+        "    <base>http://localhost/wiki/Main_Page</base>\n"
+        "    <generator>wp2git-gen</generator>\n"
+        "    <case>first-letter</case>\n"
+        "    <namespaces>\n"
+        "      <namespace key=\"0\" case=\"first-letter\" />\n";
+    for( size_t i = 0; i < ns.size(); ++i )
+        out << "      <namespace key=\"" << i+1 << "\" case=\"first-letter\">"
+            << escape(ns[i]) << "</namespace>\n";
+    out << "    </namespaces>\n"
+        "  </siteinfo>\n";
+
+    // 2005-01-01 upto 2010-01-01
+    static const std::time_t start(1104537600), end(1262304000);
+    unsigned long revid(0);
+    uint64_t revisionCount(0), textBytes(0);
+    for( unsigned long p = 1; p <= pages; ++p ) {
+        size_t n(0);
+        std::string title;
+        if( ! ns.empty() && randomReal() < ns_ratio ) {
+            n = randomInt(1, ns.size());
+            title = ns[n-1] + ':';
+        }
+        std::string name(makeText(randomInt(3, 30)));
+        name.erase(name.size()-1); // the separator
+        name[0] = std::toupper(name[0]);
+        for( size_t i = 0; i < name.size(); ++i )
+            if( name[i] == '\n' )
+                name[i] = ' ';
+        title += name + boost::lexical_cast<std::string>(p);
+        out << "  <page>\n"
+            "    <title>" << escape(title) << "</title>\n"
+            "    <ns>" << n << "</ns>\n"
+            "    <id>" << p << "</id>\n";
+        std::time_t t = randomInt(start, end);
+        std::vector<std::string> history;
+        std::string text;
+        unsigned long parent(0);
+        for( unsigned long r = randomInt(1, 2 * revisions - 1); r; --r ) {
+            double what = randomReal();
+            if( history.size() > 1 && what < 0.1 )
+                text = history[randomInt(0, history.size()-2)]; // revert
+            else if( history.empty() || what < 0.2 )
+                text = makeText(sizes(rng));
+            else if( what < 0.7 ) // insert
+                text.insert(randomInt(0, text.size()), makeText(randomInt(1, 500)));
+            else { // delete
+                size_t pos = randomInt(0, text.size());
+                text.erase(pos, randomInt(0, 500));
+            }
+            history.push_back(text);
+            t += randomInt(1, std::max<std::time_t>(1, (end - t) / (r + 1)));
+            std::time_t ts = t;
+            if( skew )
+                ts += long(randomInt(0, 2 * skew)) - long(skew);
+            ++revid;
+            unsigned long user = randomInt(1, 1000);
+            out << "    <revision>\n"
+                "      <id>" << revid << "</id>\n";
+            if( parent )
+                out << "      <parentid>" << parent << "</parentid>\n";
+            out << "      <timestamp>" << timestamp(ts) << "</timestamp>\n"
+                "      <contributor>\n";
+            if( user > 900 )
+                out << "        <ip>10.0." << user / 256 << '.' << user % 256 << "</ip>\n";
+            else
+                out << "        <username>User" << user << "</username>\n"
+                    "        <id>" << user << "</id>\n";
+            out << "      </contributor>\n";
+            if( randomReal() < 0.3 )
+                out << "      <minor />\n";
+            out << "      <comment>edit " << history.size() << " of " << escape(title) << "</comment>\n"
+                "      <model>wikitext</model>\n"
+                "      <format>text/x-wiki</format>\n"
+                "      <text xml:space=\"preserve\" bytes=\"" << text.size() << "\">"
+                << escape(text) << "</text>\n";
+            if( ! no_sha1 )
+                out << "      <sha1>" << base36Sha1(text) << "</sha1>\n";
+            out << "    </revision>\n";
+            parent = revid;
+            ++revisionCount;
+            textBytes += text.size();
+        }
+        out << "  </page>\n";
+    }
+    out << "</mediawiki>\n";
+    out.reset();
+
+    // Used by bench.sh.
+    std::cerr << "Wrote " << pages << " pages with " << revisionCount << " revisions ("
+        << textBytes << " bytes of text)." << std::endl;
+    return 0;
+}
@@ -7,14 +7,21 @@
 // i.e. the id and title of a page is defined before any revision.
 // This keeps the parser simple.
 //
-#include <malloc.h> // mallinfo()
+#include <stdint.h>
+#include <unistd.h> // unlink(), pread()
+#include <sys/stat.h>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <string>
 #include <stack>
+#include <deque>
 #include <map>
 #include <tr1/unordered_map> // You will need a gcc >= 3.x
 
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/condition_variable.hpp>
 #include <boost/iostreams/filtering_streambuf.hpp>
 #include <boost/iostreams/filter/bzip2.hpp>
 #include <boost/lexical_cast.hpp>
@@ -28,6 +35,17 @@
 #include <expat.h>
 
 #include "version.h"
+#include "digesttable.h"
+#include "sha1.h"
+#include "packwriter.h"
+#include "gitprocess.h"
+#include "output.h"
+#include "reporter.h"
+#include "metrics.h"
+#include "meminfo.h"
+#include "probes.h"
+#include "columns.h"
+#include "cache.h"
 
 #define BUFFER_SIZE 1024*1024
 
@@ -41,9 +59,14 @@ static std::string title_ns;
 static std::string username;
 static bool is_minor(false);
 static bool is_del(false); // TODO: is currently never set.
+// With --metadata-only the size of the text is only counted, by a
+// character handler used inside <text> (see countingHandler()).
+static uint64_t textBytes(0);
+static uint64_t revisionOffset(0); // where the actual revision starts (--two-pass)
 static std::string id_contributor;
 static std::string id_page;
 static std::string id_revision;
+static std::string sha1;
 boost::posix_time::ptime time_start;
 
 // Options.
@@ -56,11 +79,51 @@ static size_t max_revisions(0);
 static std::string programname;
 static std::string blacklist;
 static unsigned long revisions_total(0);
+static bool no_dedup(false);
+static std::string packdir;
+static unsigned threads(0);
+static unsigned commit_threads(0);
+static unsigned shards(1);
+static bool fast_import(false);
+static std::string export_marks;
+static unsigned long checkpoint_commits(0);
+static unsigned long checkpoint_mb(0);
+static unsigned long checkpoint_rss(0);
+static unsigned long progress(0);
+static std::string mark_table;
+static std::string layout_name("title");
+static unsigned dir_entries(1000);
+// layout_name as parsed by config().
+enum Layout {
+    Layout_title,
+    Layout_hash,
+    Layout_balanced,
+    Layout_id,
+};
+static Layout layout(Layout_title);
+static std::map<std::string, unsigned> ns_deepness;
+static unsigned report_interval(10);
+static bool verbose(false);
+static std::string metrics_file;
+static unsigned long memory_budget(0);
+static std::string outputname;
+static bool null_output(false);
+static bool metadata_only(false);
+static bool two_pass(false);
+static std::string columns_dir;
+static std::string build_cache; // write the parsed dump into this file
+static std::string cache_file; // read the parsed dump from this file
 
 // The actual code starts here.
 
 static std::fstream tfile;
 static size_t revisions_read(0);
+static unsigned long pages_read(0);
+static Reporter* reporter(NULL);
+static Metrics metrics;
+// The size and number of all revisions of the actual page.
+static uint64_t pageBytes(0);
+static unsigned long pageRevisions(0);
 
 enum Element {
     Element_unknown,
@@ -69,16 +132,18 @@ enum Element {
     Element_ip,
     Element_minor,
     Element_revision,
+    Element_sha1,
     Element_text,
     Element_timestamp,
     Element_title,
     Element_username,
+    Element_redirect,
+    Element_page,
     // The stuff below doesn't interest us.
 /*
     Element_contributor,
     Element_mediawiki,
     Element_namespace,
-    Element_page,
     Element_restrictions,
 */
 };
@@ -94,16 +159,18 @@ static void initMap(void)
     mapElementNames["ip"] = Element_ip;
     mapElementNames["minor"] = Element_minor;
     mapElementNames["revision"] = Element_revision;
+    mapElementNames["sha1"] = Element_sha1;
     mapElementNames["text"] = Element_text;
     mapElementNames["timestamp"] = Element_timestamp;
     mapElementNames["title"] = Element_title;
     mapElementNames["username"] = Element_username;
+    mapElementNames["redirect"] = Element_redirect;
+    mapElementNames["page"] = Element_page;
     // The stuff below doesn't interest us.
 /*
     mapElementNames["contributor"] = Element_contributor;
     mapElementNames["mediawiki"]=Element_mediawiki;
     mapElementNames["namespace"] = Element_namespace;
-    mapElementNames["page"] = Element_page;
     mapElementNames["restrictions"] = Element_restrictions;
 */
 }
@@ -157,14 +224,209 @@ class ForSortingString {
 };
 typedef std::set<ForSortingString> Revisions;
 static Revisions revisions;
+// The bytes used by the strings in revisions.
+static uint64_t commitStoreBytes(0);
+// Whether we have created the temporary file by ourself.
+static bool spilled(false);
+
+// With --two-pass step 1 only remembers where every revision starts in
+// the input and step 2 parses the revisions again in the order of the
+// commits, writing the blob right before the commit. Nothing but this
+// index (24 bytes per revision) and the pages has to be kept.
+class IndexEntry {
+    public:
+        IndexEntry(uint64_t o, std::time_t d, unsigned long i, uint32_t p)
+            : offset(o)
+            , date(d)
+            , id(i)
+            , page(p)
+            {}
+        uint64_t offset; // of <revision> in stdin
+        int64_t date; // might be before 1970
+        uint32_t id; // checked by indexRevision()
+        uint32_t page; // in indexPages
+        bool operator<(const IndexEntry& f) const {
+            if( date != f.date)
+                return date < f.date;
+            else
+                return id < f.id;
+        }
+};
+class IndexPage {
+    public:
+        std::string title;
+        std::string title_ns;
+        std::string id;
+};
+static std::vector<IndexEntry> revisionIndex;
+static std::vector<IndexPage> indexPages;
+static size_t indexedPage(0); // the value of pages_read when the last page was added
+static off_t indexBase(0); // the position of stdin when we started
+// What the expat callbacks are doing with a revision.
+static enum Reading {
+    Reading_all, // create the blob and the commit
+    Reading_index, // step 1 of --two-pass
+    Reading_emit // step 2 of --two-pass
+} reading(Reading_all);
+static bool revisionDone(false); // set in Reading_emit
+static std::string emitFrom; // the last commit in Reading_emit
 
 static std::string actualValue;
 
+// Reverts and null edits are producing many revisions with a text we
+// already have sent to git. We remember the SHA-1 of every blob together
+// with its mark and reuse that mark instead of sending the text again.
+static DigestTable blobDigests;
+static unsigned long dedupedBlobs(0);
+static unsigned long long dedupedBytes(0);
+
+// Marks are given densely to keep the mark table of git fast-import (and
+// an exported marks file) small. Blobs are getting 1..n in the order they
+// are written (in a pack that's their index), commits the following marks
+// in the order they are written in step 2.
+static unsigned long blobMarks(0); // the last mark given to a blob
+static unsigned long commitMarks(0); // the number of commits written
+// The mark before the first commit. With --two-pass the blobs and
+// commits are written interleaved, so the commits are starting after the
+// highest possible blob mark.
+static unsigned long commitMarkBase(0);
+
+// Maps the marks back to revision ids (optional). The file starts with
+// the magic "WP2GMRK1", the number of blobs and the number of commits
+// (64 bit each), followed by the revision id (32 bit) of every mark in
+// the order of the marks. Everything is little endian.
+class MarkTable {
+    public:
+        MarkTable() : count(0) {}
+        void open(const std::string& name) {
+            filename = name;
+            file.open(name.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+            file.write("WP2GMRK1", 8);
+            put(0, 8);
+            put(0, 8);
+            check();
+        }
+        bool isOpen(void) const { return file.is_open(); }
+        // Has to be called for every mark, in the order of the marks.
+        void add(unsigned long id) {
+            if( id > 0xffffffffUL ) {
+                std::cerr << "ERROR: Revision id " << id << " doesn't fit into the mark table!" << std::endl;
+                exit(4);
+            }
+            put(id, 4);
+            ++count;
+        }
+        void close(unsigned long blobs) {
+            file.seekp(8);
+            put(blobs, 8);
+            put(count - blobs, 8);
+            check();
+            file.close();
+        }
+    private:
+        void put(uint64_t v, unsigned bytes) {
+            char b[8];
+            for( unsigned i = 0; i < bytes; ++i )
+                b[i] = char(v >> (i*8));
+            file.write(b, bytes);
+        }
+        void check(void) {
+            if( ! file ) {
+                std::cerr << "ERROR: Can't write to file '" << filename << "'!" << std::endl;
+                exit(3);
+            }
+        }
+        std::string filename;
+        std::ofstream file;
+        unsigned long count;
+};
+static MarkTable markTable;
+
+// Used instead of git fast-import if packdir is given.
+static PackWriter* pack(NULL);
+static TreeWriter* packTree(NULL);
+static PackWriter::Base pageBase; // the last blob of the actual page
+
 static std::set<std::string> ns_blacklist;
 static bool ignorePage(false); // Will be set to true if the title of page is found in the blacklist
 static unsigned long ignoredPages(0);
 static unsigned long ignoredRevisions(0);
 
+// Filters. They are checked as soon as the element they need is read, the
+// texts of ignored pages and skipped revisions aren't even collected.
+static std::string pages_file; // only import these titles
+// The 64 bit hashes of the titles in pages_file, sorted. A false positive
+// is unlikely enough even for millions of titles, and 8 bytes per title
+// are less than a set of the titles would need.
+static std::vector<uint64_t> allowedTitles;
+static std::vector< std::pair<unsigned long, unsigned long> > page_ids; // ranges (incl.)
+static std::string since, until; // compared with the timestamps as strings
+static bool no_redirects(false);
+static bool no_minor(false);
+static bool skipRevision(false); // the actual revision is filtered out
+static unsigned long skippedRevisions(0);
+static bool countingText(false); // countingHandler() is in use
+
+// Used with --build-cache.
+static CacheWriter* cacheOut(NULL);
+
+// With --keep-last only the last n revisions of every page are imported.
+// The revisions of a page are kept here until its end, the older ones are
+// dropped as soon as there are more than n.
+class KeptRevision {
+    public:
+        KeptRevision()
+            : is_minor(false)
+            , textBytes(0)
+            , offset(0)
+            {}
+        std::string comment;
+        std::string ip;
+        std::string sha1;
+        std::string text;
+        std::string timestamp;
+        std::string username;
+        std::string id_contributor;
+        std::string id_revision;
+        bool is_minor;
+        uint64_t textBytes;
+        uint64_t offset;
+};
+static unsigned keep_last(0);
+static std::deque<KeptRevision> keptRevisions;
+static unsigned long droppedRevisions(0);
+
+// With --squash consecutive revisions of a page by the same contributor
+// are combined into one commit (with the last text and all comments), as
+// long as they are made within that many seconds after each other. The
+// revision squashed into is kept here until the next one is known.
+static unsigned long squash_window(0);
+static KeptRevision squashed;
+static bool squashing(false); // squashed contains a revision
+static std::time_t squashedDate(0);
+static unsigned long squashedRevisions(0);
+
+// With --snapshot-interval only the last revision of a page in every
+// interval is kept (using the same way as --squash) and step 2 writes one
+// commit per interval, containing all pages changed in it.
+static std::string snapshot_interval; // month, week, day or seconds
+// snapshot_interval as parsed by config().
+enum Interval {
+    Interval_none,
+    Interval_seconds, // incl. day
+    Interval_week,
+    Interval_month,
+    Interval_all, // --single-tree
+};
+static Interval interval(Interval_none);
+static unsigned long snapshotSeconds(0);
+static unsigned long supersededRevisions(0); // by a later one in the snapshot
+// --single-tree is a snapshot of everything (interval all), written in
+// commits of up to tree_chunk files.
+static bool single_tree(false);
+static unsigned long tree_chunk(0);
+static unsigned long multiRevisionPages(0); // to detect a current dump
+
 static void printHelp(const std::string& myName,
     const boost::program_options::options_description& desc)
 {
@@ -184,12 +446,26 @@ static void printHelp(const std::string& myName,
         << myName << " -m 100000 -b blacklist.example | bzip2 >stream_for_git-fast-import.bz2" << std::endl;
     std::cerr << myName
         << " -c \"Foo Bar <foo@bar.local>\" -d 10 -w barwiki-20091206-pages-articles.xml.bz2 | GIT_DIR=repo git fast-import" << std::endl;
+    std::cerr << myName
+        << " -p repo/.git barwiki-20091206-pages-articles.xml.bz2" << std::endl;
+    std::cerr << "GIT_DIR=repo " << myName
+        << " -s 8 barwiki-20091206-pages-articles.xml.bz2" << std::endl;
+    std::cerr << "GIT_DIR=repo " << myName
+        << " -g --checkpoint-commits 1000000 --progress 100000 barwiki-20091206-pages-articles.xml.bz2" << std::endl;
     std::cerr << myName
         << " show-me-only-page-titles.xml.bz2 >/dev/null" << std::endl;
     std::cerr << std::endl;
     return;
 }
 
+// Tells if options which can't be used together were given.
+static bool conflicts(bool given, const char* options)
+{
+    if( given )
+        std::cerr << "ERROR: " << options << " can't be used together!" << std::endl;
+    return given;
+}
+
 int config(int argc, char** argv)
 {
     {
@@ -209,15 +485,89 @@ int config(int argc, char** argv)
         ("committer,c", boost::program_options::value<std::string>(&committer),
             std::string("git \"Committer\" used while doing the commits (default \"" + committer + "\")").c_str())
         ("deepness,d", boost::program_options::value<unsigned>(&deepness),
-            "The deepness of the result directory structure (default 3)")
+            "The deepness of the result directory structure, with layout title the namespace counts as one level (default 3)")
+        ("layout,l", boost::program_options::value<std::string>(&layout_name),
+            "The layout of the directory structure: title (a directory per char of the title), hash (of the title, at most 4 levels), balanced (by the titles found) or id (of the page) (default title)")
+        ("dir-entries", boost::program_options::value<unsigned>(&dir_entries),
+            "The maximum number of pages in a directory with layout balanced (default 1000)")
+        ("ns-deepness", boost::program_options::value< std::vector<std::string> >(),
+            "NS=N sets the deepness to N for the namespace NS (=N for the main namespace), the namespace doesn't count, can be given multiple times")
+        ("report-interval", boost::program_options::value<unsigned>(&report_interval),
+            "Print the progress every n seconds, 0 prints it only on SIGUSR1 (default 10)")
+        ("metrics", boost::program_options::value<std::string>(&metrics_file),
+            "Write the time needed by every stage and some more statistics as JSON into this file")
+        ("output,o", boost::program_options::value<std::string>(&outputname),
+            "Write the stream for git fast-import into this file instead of stdout (compressed if it ends with .gz)")
+        ("null-output", boost::program_options::bool_switch(&null_output),
+            "Throw the stream away (to measure wp2git without git fast-import)")
+        ("metadata-only", boost::program_options::bool_switch(&metadata_only),
+            "Don't import the texts, the blobs only contain the size and the SHA-1 (if the dump has it) of the text")
+        ("columns", boost::program_options::value<std::string>(&columns_dir),
+            "Write the metadata of the revisions column by column into this directory (see columns.h)")
+        ("build-cache", boost::program_options::value<std::string>(&build_cache),
+            "Write the parsed dump into this file, to be used by later runs with --cache (not together with --max)")
+        ("cache", boost::program_options::value<std::string>(&cache_file),
+            "Read the parsed dump from this file (written with --build-cache) instead of the XML")
+        ("two-pass", boost::program_options::bool_switch(&two_pass),
+            "Only index the revisions in step 1 and read them again from stdin (which has to be an uncompressed file) in step 2")
+        ("memory-budget", boost::program_options::value<unsigned long>(&memory_budget),
+            "Move the commits to a temporary file in $TMPDIR if more than this many MB would be used (default 0 = never)")
+        ("pages", boost::program_options::value<std::string>(&pages_file),
+            "Only import the pages with the titles (incl. the namespace) listed in this file (default all)")
+        ("page-ids", boost::program_options::value<std::string>(),
+            "Only import the pages with these ids, e.g. 1-1000,5000,10000- (default all)")
+        ("since", boost::program_options::value<std::string>(&since),
+            "Only import revisions made at or after this time (e.g. 2008-01-01 or 2008-01-01T12:00:00Z)")
+        ("until", boost::program_options::value<std::string>(&until),
+            "Only import revisions made before this time")
+        ("no-redirects", boost::program_options::bool_switch(&no_redirects),
+            "Don't import redirect pages")
+        ("no-minor", boost::program_options::bool_switch(&no_minor),
+            "Don't import minor edits")
+        ("squash", boost::program_options::value<unsigned long>(&squash_window),
+            "Combine revisions of a page by the same contributor made within that many seconds after each other into one commit (default 0 = never)")
+        ("snapshot-interval", boost::program_options::value<std::string>(&snapshot_interval),
+            "Write only one commit per interval (month, week, day or a number of seconds) with the state of all pages changed in it")
+        ("single-tree", boost::program_options::bool_switch(&single_tree),
+            "Write only the last revision of every page, all in one commit (for dumps with one revision per page)")
+        ("tree-chunk", boost::program_options::value<unsigned long>(&tree_chunk),
+            "Split the commit of --single-tree (only) into commits of that many files (default 0 = one commit)")
+        ("keep-last", boost::program_options::value<unsigned>(&keep_last),
+            "Only import the last n revisions of every page (default 0 = all)")
+        ("verbose,v", boost::program_options::bool_switch(&verbose),
+            "Print the title of every page")
         ("max,m", boost::program_options::value<size_t>(&max_revisions),
             "Maximum number of revisions (not pages!) to import (default 0 = all)")
         ("revisions,r", boost::program_options::value<unsigned long>(&revisions_total),
-            "The total number of revisions (used to calc ETA)")
+            "The total number of revisions (used to calc ETA if the size of the input is unknown)")
         ("tempfile,t", boost::program_options::value<std::string>(&tempfilename),
             "Use this temporary file to minimize RAM-usage")
         ("wikitime,w", boost::program_options::bool_switch(&wikitime),
             "TODO: If true, the commit time will be set to the revision creation, not the current system time (default false)")
+        ("no-dedup", boost::program_options::bool_switch(&no_dedup),
+            "Send every revision text to git, even if the same text was already sent before (default false)")
+        ("pack,p", boost::program_options::value<std::string>(&packdir),
+            "Write a pack directly into this git directory instead of a stream for git fast-import")
+        ("shards,s", boost::program_options::value<unsigned>(&shards),
+            "Start git fast-import by ourself (using GIT_DIR) and write the commits in parallel to that many of them (default 1 = write to stdout)")
+        ("fast-import,g", boost::program_options::bool_switch(&fast_import),
+            "Start git fast-import by ourself (using GIT_DIR) instead of writing to stdout (default false)")
+        ("export-marks", boost::program_options::value<std::string>(&export_marks),
+            "Let git fast-import (started with -g) export its marks into this file")
+        ("checkpoint-commits", boost::program_options::value<unsigned long>(&checkpoint_commits),
+            "Let git fast-import (started with -g or -s) write a checkpoint every that many commits (default 0 = never)")
+        ("checkpoint-mb", boost::program_options::value<unsigned long>(&checkpoint_mb),
+            "Let git fast-import (started with -g or -s) write a checkpoint every that many MB written to it (default 0 = never)")
+        ("checkpoint-rss", boost::program_options::value<unsigned long>(&checkpoint_rss),
+            "Let git fast-import (started with -g or -s) write a checkpoint when it starts to use more than that many MB of RAM, again only after it went below (default 0 = never)")
+        ("progress", boost::program_options::value<unsigned long>(&progress),
+            "Let git fast-import (started with -g or -s) print a progress line every that many blobs and commits (default 0 = never)")
+        ("mark-table", boost::program_options::value<std::string>(&mark_table),
+            "Write a (binary) table which maps the marks back to revision ids into this file")
+        ("threads", boost::program_options::value<unsigned>(&threads),
+            "Number of threads used to compress the pack (default 0 = number of cpus)")
+        ("commit-threads", boost::program_options::value<unsigned>(&commit_threads),
+            "Number of threads formatting the commits in step 2 (default 0 = number of cpus)")
         ("mediawiki-export-bz2", boost::program_options::value< std::vector<std::string> >(), "file to read")
         ;
         boost::program_options::positional_options_description podesc;
@@ -242,6 +592,128 @@ int config(int argc, char** argv)
     }
     else if(vm.count("mediawiki-export-bz2") == 1 )
         filename = vm["mediawiki-export-bz2"].as< std::vector<std::string> >()[0];
+    if( layout_name == "hash" )
+        layout = Layout_hash;
+    else if( layout_name == "balanced" )
+        layout = Layout_balanced;
+    else if( layout_name == "id" )
+        layout = Layout_id;
+    else if( layout_name != "title" ) {
+        std::cerr << "ERROR: Unknown layout '" << layout_name << "'!" << std::endl;
+        return 3;
+    }
+    if( vm.count("ns-deepness") ) {
+        const std::vector<std::string>& v(vm["ns-deepness"].as< std::vector<std::string> >());
+        for( size_t i = 0; i < v.size(); ++i ) {
+            size_t eq = v[i].rfind('=');
+            try {
+                if( eq == std::string::npos )
+                    throw std::exception();
+                ns_deepness[v[i].substr(0, eq)] = boost::lexical_cast<unsigned>(v[i].substr(eq+1));
+            }
+            catch (std::exception& e) {
+                std::cerr << "ERROR: --ns-deepness needs NS=N, not '" << v[i] << "'!" << std::endl;
+                return 3;
+            }
+        }
+    }
+    if( layout == Layout_hash ) {
+        // The hash has only 32 bit (two hex digits per level).
+        unsigned levels(deepness);
+        for( std::map<std::string, unsigned>::const_iterator i = ns_deepness.begin();
+                i != ns_deepness.end(); ++i )
+            levels = std::max(levels, i->second);
+        if( levels > 4 ) {
+            std::cerr << "ERROR: Layout hash has at most 4 levels!" << std::endl;
+            return 3;
+        }
+    }
+    if( vm.count("page-ids") ) {
+        std::istringstream ranges(vm["page-ids"].as<std::string>());
+        std::string range;
+        while( std::getline(ranges, range, ',') ) {
+            size_t dash = range.find('-');
+            try {
+                unsigned long from = boost::lexical_cast<unsigned long>(range.substr(0, dash));
+                unsigned long to(from);
+                if( dash != std::string::npos )
+                    to = dash + 1 == range.size() ? (unsigned long)-1
+                        : boost::lexical_cast<unsigned long>(range.substr(dash+1));
+                if( to < from ) {
+                    std::cerr << "ERROR: The range '" << range << "' in --page-ids is reversed!" << std::endl;
+                    return 3;
+                }
+                page_ids.push_back(std::make_pair(from, to));
+            }
+            catch (std::exception& e) {
+                std::cerr << "ERROR: Invalid range '" << range << "' in --page-ids!" << std::endl;
+                return 3;
+            }
+        }
+    }
+    if( single_tree ) {
+        if( conflicts(! snapshot_interval.empty(), "--single-tree and --snapshot-interval") )
+            return 3;
+        interval = Interval_all;
+    }
+    else if( snapshot_interval == "month" )
+        interval = Interval_month;
+    else if( snapshot_interval == "week" )
+        interval = Interval_week;
+    else if( snapshot_interval == "day" ) {
+        interval = Interval_seconds;
+        snapshotSeconds = 86400;
+    }
+    else if( ! snapshot_interval.empty() ) {
+        try {
+            snapshotSeconds = boost::lexical_cast<unsigned long>(snapshot_interval);
+        }
+        catch (std::exception& e) {
+        }
+        if( ! snapshotSeconds ) {
+            std::cerr << "ERROR: Unknown interval '" << snapshot_interval << "'!" << std::endl;
+            return 3;
+        }
+        interval = Interval_seconds;
+    }
+    // A pack must not contain an object twice.
+    if( ! packdir.empty() )
+        no_dedup = false;
+    if( ! shards ) {
+        std::cerr << "ERROR: --shards has to be at least 1!" << std::endl;
+        return 3;
+    }
+    if( ! export_marks.empty() && ! fast_import ) {
+        std::cerr << "ERROR: --export-marks needs -g!" << std::endl;
+        return 3;
+    }
+    if( tree_chunk && ! single_tree ) {
+        std::cerr << "ERROR: --tree-chunk needs --single-tree!" << std::endl;
+        return 3;
+    }
+    if( conflicts(shards > 1 && ! packdir.empty(), "-s and -p")
+            || conflicts(fast_import && ( shards > 1 || ! packdir.empty() ), "-g and -s or -p")
+            || conflicts(! mark_table.empty() && ! packdir.empty(), "--mark-table and -p")
+            || conflicts(( null_output || ! outputname.empty() )
+                && ( fast_import || shards > 1 || ! packdir.empty() ),
+                "-o or --null-output and -g, -s or -p")
+            || conflicts(null_output && ! outputname.empty(), "-o and --null-output")
+            || conflicts(two_pass && ( ! filename.empty() || shards > 1 || ! packdir.empty()
+                || ! tempfilename.empty() || ! mark_table.empty() ),
+                "--two-pass and a file, -s, -p, -t or --mark-table")
+            || conflicts(! build_cache.empty() && ( metadata_only || two_pass || max_revisions ),
+                "--build-cache and --metadata-only, --two-pass or --max")
+            || conflicts(! cache_file.empty() && ( ! filename.empty() || two_pass ),
+                "--cache and a file or --two-pass")
+            || conflicts(squash_window && two_pass, "--squash and --two-pass")
+            || conflicts(keep_last && ( squash_window || interval != Interval_none ),
+                "--keep-last and --squash, --snapshot-interval or --single-tree")
+            || conflicts(interval != Interval_none && ( squash_window || two_pass
+                || shards > 1 || ! packdir.empty() || ! mark_table.empty() ),
+                "--snapshot-interval or --single-tree and --squash, --two-pass, -s, -p or --mark-table") )
+        return 3;
+    if( ! metrics_file.empty() )
+        metrics.enable();
     if( ! max_revisions )
         max_revisions = (unsigned long)-1;
     else
@@ -273,24 +745,149 @@ static std::string asciiize(const std::string& str)
     return s;
 }
 
-static std::string buildCommitString(std::time_t date)
+// Layouts of the directory structure.
+//
+// With the layout title, every char of the title is a directory level,
+// which might produce directories with a huge number of entries (and
+// every commit has to rewrite such a tree). The other layouts are
+// keeping the trees small:
+// - hash uses two hex digits of a hash of the title per level,
+// - id uses two (decimal) digits of the page id per level (starting with
+//   the least significant ones),
+// - balanced splits a directory by the next char of the title only if
+//   more than dir_entries pages would be in it. This needs all titles,
+//   therefor the commits only contain the title (as namespace/title) in
+//   step 1 and the directories are added in step 2 (see balance()).
+
+// Returns the deepness for the actual namespace or -1 if not set.
+static int nsDeepness(void)
 {
-    std::string str("author ");
-    if( ! username.empty() ) {
-        str += username;
-        str += " <uid-" + id_contributor;
+    std::map<std::string, unsigned>::const_iterator i = ns_deepness.find(title_ns);
+    if( i == ns_deepness.end() )
+        return -1;
+    return i->second;
+}
+
+static std::string buildFilename(void)
+{
+    std::string tfilename(title_ns);
+    if( layout == Layout_balanced )
+        return tfilename + '/' + asciiize(title);
+    int levels = nsDeepness();
+    if( ! tfilename.empty() )
+        tfilename += '/';
+    if( layout == Layout_hash ) {
+        // FNV-1a
+        uint32_t h(2166136261u);
+        for( size_t i = 0; i < title.size(); ++i )
+            h = (h ^ (unsigned char)title[i]) * 16777619u;
+        static const char hexChars[] = "0123456789abcdef";
+        if( levels < 0 )
+            levels = deepness;
+        for( int i = 0; i < levels; ++i ) {
+            tfilename += hexChars[(h >> (i*8+4)) & 0x0f];
+            tfilename += hexChars[(h >> (i*8)) & 0x0f];
+            tfilename += '/';
+        }
+    }
+    else if( layout == Layout_id ) {
+        unsigned long id = boost::lexical_cast<unsigned long>(id_page);
+        if( levels < 0 )
+            levels = deepness;
+        for( int i = 0; i < levels; ++i, id /= 100 ) {
+            tfilename += '0' + (id / 10) % 10;
+            tfilename += '0' + id % 10;
+            tfilename += '/';
+        }
+        return tfilename + id_page + ".mediawiki";
     }
     else {
-        str += ip;
-        str += " <ip";
+        // With -d the namespace counts as a level (as it always did),
+        // with --ns-deepness only the title does.
+        unsigned i(0);
+        if( ! tfilename.empty() )
+            i = 1;
+        if( levels >= 0 )
+            levels += i;
+        else
+            levels = deepness;
+        for( ; i<unsigned(levels) && i<title.size(); ++i ) {
+            tfilename += asciiize_char(title[i]);
+            tfilename += '/';
+        }
+    }
+    tfilename += asciiize(title);
+    tfilename += ".mediawiki";
+    return tfilename;
+}
+
+// All imported pages as namespace/asciiized title, sorted after step 1. A
+// page is added at its first revision, when all filters of the page are
+// known.
+static std::vector<std::string> balancedTitles;
+static uint64_t balancedTitlesBytes(0);
+static bool titleBalanced(false); // the actual page is in balancedTitles
+
+// Adds the directories of the layout balanced to the path in the
+// commit string.
+static std::string balance(const std::string& str)
+{
+    size_t m_start = str.rfind('\n')+1;
+    size_t path_start = str.find(' ', str.find(':', m_start))+1;
+    size_t slash = str.find('/', path_start);
+    std::string path(str, path_start, slash+1-path_start); // with the namespace
+    std::string prefix(path);
+    std::string name(str, slash+1);
+    std::vector<std::string>::const_iterator begin(balancedTitles.begin());
+    std::vector<std::string>::const_iterator end(balancedTitles.end());
+    int levels = -1;
+    std::map<std::string, unsigned>::const_iterator nd = ns_deepness.find(path.substr(0, path.size()-1));
+    if( nd != ns_deepness.end() )
+        levels = nd->second;
+    for( size_t i = 0; i < name.size() && levels; --levels ) {
+        // Pages with this prefix.
+        begin = std::lower_bound(begin, end, prefix);
+        end = std::lower_bound(begin, end, prefix + '\x7f');
+        if( size_t(end - begin) <= dir_entries )
+            break;
+        // The next char (asciiize_char() produces .XX or a single char).
+        size_t len = name[i] == '.' ? 3 : 1;
+        prefix.append(name, i, len);
+        path.append(name, i, len);
+        path += '/';
+        i += len;
     }
-    str += "@git.bar.wikipedia.org> ";
+    if( path[0] == '/' ) // main namespace
+        path.erase(0, 1);
+    return str.substr(0, path_start) + path + name + ".mediawiki";
+}
+
+// The author and committer lines of a commit, author incl. the email.
+static std::string commitHeader(const std::string& author, std::time_t date)
+{
+    std::string str("author " + author + ' ');
     str += boost::lexical_cast<std::string>(date);
     // TODO: Fix timezone (using boost::local_time).
     str += " +0000\n";
     str += "committer " + committer + ' ';
     // TODO: Fix timezone (using boost::local_time).
     str += boost::lexical_cast<std::string>(time(NULL))+ " +0100\n";
+    return str;
+}
+
+static std::string buildCommitString(std::time_t date, unsigned long blob_mark)
+{
+    std::string author;
+    if( ! username.empty() ) {
+        author += username;
+        author += " <uid-" + id_contributor;
+    }
+    else {
+        author += ip;
+        author += " <ip";
+    }
+    author += "@git.bar.wikipedia.org>";
+    std::string str(commitHeader(author, date));
     std::string commit_comment("\n\nwp2git " VERSION " import of"
         " page " + id_page
         + " rev " + id_revision
@@ -303,22 +900,8 @@ static std::string buildCommitString(std::time_t date)
     str += "data " + boost::lexical_cast<std::string>(commit_title.size() + comment.size() + commit_comment.size()) + '\n';
     str += commit_title + comment + commit_comment + '\n';
 
-    // Build the filename
-    std::string tfilename(title_ns);
-    unsigned i(0);
-    if( ! tfilename.empty() ) {
-        tfilename += '/';
-        ++i;
-    }
-    for( ; i<deepness && i<title.size(); ++i ) {
-        tfilename += asciiize_char(title[i]);
-        tfilename += '/';
-    }
-    tfilename += asciiize(title);
-    tfilename += ".mediawiki";
-
-    str += "M 100644 :" + id_revision
-        + ' ' + tfilename;
+    str += "M 100644 :" + boost::lexical_cast<std::string>(blob_mark)
+        + ' ' + buildFilename();
     return str;
 }
 
@@ -328,6 +911,7 @@ static std::streampos writeString(const std::string& str)
     try {
         pos = tfile.tellp();
         size_t len = str.size();
+        PROBE2(tempfile_write, (long long)pos, len);
         tfile.write(reinterpret_cast<const char*>(&len), sizeof(len));
         tfile.write(str.data(), str.size());
     }
@@ -339,16 +923,58 @@ static std::streampos writeString(const std::string& str)
     return pos;
 }
 
-static std::string readString(std::streampos pos)
+static void openTfile(void)
+{
+    tfile.exceptions( std::fstream::failbit | std::fstream::badbit );
+    //tfile.exceptions( std::ifstream::eofbit | std::fstream::failbit | std::fstream::badbit );
+    try {
+        tfile.open(tempfilename,
+            std::fstream::binary | std::fstream::in | std::fstream::out | std::fstream::trunc);
+    }
+    catch (std::exception& e) {
+        // e.what() offers only cryptic errors here
+        std::cerr << "ERROR: Can't open file '" << tempfilename << "'!" << std::endl;
+        exit(2);
+    }
+}
+
+// The memory budget is nearly used up, we are moving the commits into
+// a temporary file (as if -t had been given) and continue with it.
+static void spill(void)
+{
+    const char* tmpdir = getenv("TMPDIR");
+    std::string name(std::string(tmpdir && *tmpdir ? tmpdir : "/tmp") + "/wp2git-XXXXXX");
+    std::vector<char> buf(name.begin(), name.end());
+    buf.push_back(0);
+    int fd = mkstemp(&buf[0]);
+    if( fd < 0 ) {
+        std::cerr << "ERROR: Can't create a temporary file in '" << name << "'!" << std::endl;
+        exit(2);
+    }
+    close(fd);
+    tempfilename = &buf[0];
+    spilled = true;
+    std::cerr << "Memory budget of " << memory_budget << " MB nearly reached, moving "
+        << revisions.size() << " commits to '" << tempfilename << "'." << std::endl;
+    openTfile();
+    for( Revisions::iterator i = revisions.begin(); i != revisions.end(); )  {
+        revisionPositions.insert(ForSortingPos(i->date, i->id, writeString(i->str)));
+        revisions.erase(i++);
+    }
+    commitStoreBytes = 0;
+}
+
+static std::string readString(std::istream& f, std::streampos pos)
 {
    try {
-        tfile.seekp(pos);
+        f.seekg(pos);
         size_t len;
-        tfile.read(reinterpret_cast<char*>(&len), sizeof(len));
+        f.read(reinterpret_cast<char*>(&len), sizeof(len));
         if(!len)
             return "";
+        PROBE2(tempfile_read, (long long)pos, len);
         std::vector<char> v(len);
-        tfile.read(&v[0], len);
+        f.read(&v[0], len);
         return std::string(v.begin(), v.end());
     }
     catch (std::exception& e) {
@@ -358,7 +984,12 @@ static std::string readString(std::streampos pos)
     }
 }
 
-static std::time_t time_t_from_timestamp(void)
+static std::string readString(std::streampos pos)
+{
+    return readString(tfile, pos);
+}
+
+static std::time_t time_t_from_timestamp(std::string timestamp)
 {
     // We assume the following format for timestamps: 2009-12-01T12:09:31Z
     assert( timestamp.size() == 20 );
@@ -375,72 +1006,553 @@ static std::time_t time_t_from_timestamp(void)
     // TODO: Fix date according timezone (using boost::local_time).
 }
 
-static void output_blob(void)
+static std::time_t time_t_from_timestamp(void)
+{
+    return time_t_from_timestamp(timestamp);
+}
+
+// Where blobs are going to, usually stdout.
+static Output* output(NULL);
+// Used instead of output with -o or --null-output.
+static FileOutput* fileOutput(NULL);
+static GzipOutput* gzipOutput(NULL);
+static NullOutput* nullOutput(NULL);
+
+// Calls f with the output in use. This is the only place deciding between
+// them, f is instantiated for every type of output (no virtual calls).
+template<class F>
+static void withOutput(F& f)
+{
+    if( fileOutput )
+        f(*fileOutput);
+    else if( gzipOutput )
+        f(*gzipOutput);
+    else if( nullOutput )
+        f(*nullOutput);
+    else
+        f(*output);
+}
+
+// Hands a text (e.g. an already formatted commit) over to the output.
+class TextWriter {
+    public:
+        explicit TextWriter(std::string& t) : text(t) {}
+        template<class Out>
+        void operator()(Out& out) { out.writeText(text); }
+    private:
+        std::string& text;
+};
+
+// Checkpoints and progress for a git fast-import started by us.
+class ImportControl {
+    public:
+        ImportControl(GitProcess& g, const std::string& n)
+            : git(g)
+            , name(n)
+            , records(0)
+            , commits(0)
+            , bytes(0)
+            , commitsCheckpoint(0)
+            , bytesCheckpoint(0)
+            , rssCheckpointed(false)
+            , time_start(boost::posix_time::second_clock::local_time())
+            {}
+        // Has to be called after every blob or commit written.
+        void written(Output& out, size_t size, bool commit) {
+            ++records;
+            bytes += size;
+            if( commit )
+                ++commits;
+            bool checkpoint(false);
+            if( checkpoint_commits && commits - commitsCheckpoint >= checkpoint_commits )
+                checkpoint = true;
+            if( checkpoint_mb && bytes - bytesCheckpoint >= checkpoint_mb * 1024 * 1024 )
+                checkpoint = true;
+            // Reading /proc is too expensive to be done for every record.
+            // A checkpoint doesn't make git fast-import smaller, so we
+            // write only one until its RSS has dropped below the limit.
+            if( checkpoint_rss && ! (records % 10000) ) {
+                bool over = git.rss() > checkpoint_rss * 1024 * 1024;
+                if( over && ! rssCheckpointed )
+                    checkpoint = true;
+                rssCheckpointed = over;
+            }
+            if( checkpoint ) {
+                out.write("checkpoint\n\n");
+                commitsCheckpoint = commits;
+                bytesCheckpoint = bytes;
+            }
+            if( checkpoint || ( progress && ! (records % progress) ) ) {
+                boost::posix_time::time_duration d(
+                    boost::posix_time::second_clock::local_time() - time_start);
+                std::ostringstream line;
+                line << "progress " << name << ": " << records << " records ("
+                    << commits << " commits), " << bytes / (1024 * 1024) << " MB written, "
+                    << boost::posix_time::to_simple_string(d) << " elapsed, "
+                    << int(git.waited()) << " s waited for git"
+                    << (checkpoint ? ", checkpoint" : "") << "\n\n";
+                out.write(line.str());
+            }
+        }
+    private:
+        GitProcess& git;
+        std::string name;
+        unsigned long records;
+        unsigned long commits;
+        unsigned long long bytes;
+        unsigned long commitsCheckpoint;
+        unsigned long long bytesCheckpoint;
+        bool rssCheckpointed; // since the RSS went over checkpoint_rss
+        boost::posix_time::ptime time_start;
+};
+// Used for blobs and the commits written with output_commit(str, from).
+static ImportControl* importControl(NULL);
+// Seconds spent waiting for git fast-import started by us.
+static double waitedForGit(0);
+
+// Writes text as the blob with the mark blobMarks.
+template<class Out>
+static void write_blob(Out& out)
+{
+    out.write("blob\n");
+    out.write("mark :");
+    out.writeNumber(blobMarks);
+    out.write("\ndata ");
+    out.writeNumber(text.size());
+    out.write('\n');
+    // The output takes over the text instead of copying it.
+    out.writeText(text);
+    out.write('\n');
+}
+
+class BlobWriter {
+    public:
+        template<class Out>
+        void operator()(Out& out) { write_blob(out); }
+};
+
+static unsigned long output_blob(unsigned long id)
+{
+    if( markTable.isOpen() )
+        markTable.add(id);
+    if( pack ) {
+        // The text isn't needed anymore, so we don't copy it.
+        boost::shared_ptr<std::string> data(new std::string);
+        data->swap(text);
+        blobMarks = pack->add(PackWriter::Type_blob, data, &pageBase);
+        PROBE2(blob, blobMarks, data->size());
+        return blobMarks;
+    }
+    size_t size(text.size());
+    ++blobMarks;
+    BlobWriter writer;
+    withOutput(writer);
+    // Only set if output is a git fast-import started by us.
+    if( importControl )
+        importControl->written(*output, size, false);
+    PROBE2(blob, blobMarks, size);
+    return blobMarks;
+}
+
+// Converts the base 36 SHA-1 found in newer dumps into the binary form.
+static bool digest_from_base36(const std::string& str, DigestTable::Digest& digest)
+{
+    if( str.empty() )
+        return false;
+    std::fill(digest, digest+20, 0);
+    for( size_t i = 0; i < str.size(); ++i ) {
+        char c = str[i];
+        uint64_t carry;
+        if( c >= '0' && c <= '9' )
+            carry = c - '0';
+        else if( c >= 'a' && c <= 'z' )
+            carry = c - 'a' + 10;
+        else
+            return false;
+        // digest[0] is the most significant byte.
+        for( int b = 19; b >= 0; --b ) {
+            carry += unsigned(digest[b]) * 36;
+            digest[b] = (unsigned char)carry;
+            carry >>= 8;
+        }
+        if( carry )
+            return false;
+    }
+    return true;
+}
+
+static void text_digest(DigestTable::Digest& digest)
+{
+    // The dump doesn't offer the SHA-1 for deleted texts, and for those with
+    // an empty text we don't trust it.
+    if( text.empty() || ! digest_from_base36(sha1, digest) )
+        sha1Digest(text.data(), text.size(), digest);
+}
+
+// The metadata of every imported revision (optional).
+static Columns* columns(NULL);
+
+static void addColumns(unsigned long id, std::time_t date, uint64_t size)
 {
-    std::cout << "blob\n";
-    // TODO: Currently I don't know why import.py uses + 1,
-    // that might be to avoid revisions with 0.
-    //std::cout << "mark :" << id_revision + 1 << '\n';
-    std::cout << "mark :" << id_revision << '\n';
-    std::cout << "data " << text.size() << '\n';
-    std::cout << text << '\n';
+    columns->number(boost::lexical_cast<unsigned long>(id_page));
+    columns->string(title_ns.empty() ? title : title_ns + ':' + title);
+    columns->number(id);
+    columns->number(date);
+    columns->number(username.empty() || id_contributor.empty() ? 0
+        : boost::lexical_cast<unsigned long>(id_contributor));
+    columns->string(username);
+    columns->string(ip);
+    columns->number(is_minor);
+    columns->string(comment);
+    columns->number(size);
+    columns->endRow();
+}
+
+// Writes the blob of the actual revision (if it isn't a duplicate) and
+// returns the string for its commit.
+static std::string revisionCommit(unsigned long id, std::time_t date)
+{
+    if( metadata_only ) {
+        // The blob only describes the text.
+        text = "size " + boost::lexical_cast<std::string>(textBytes) + '\n';
+        if( ! sha1.empty() )
+            text += "sha1 " + sha1 + '\n';
+    }
+    size_t size(text.size());
+    metrics.revisionSize(id, size);
+    pageBytes += size;
+    DigestTable::Digest digest;
+    unsigned long blob_mark(0);
+    if( ! no_dedup ) {
+        Metrics::Timer timer(metrics, Metrics::Stage_hash);
+        text_digest(digest);
+        blob_mark = blobDigests.find(digest);
+    }
+    if( blob_mark ) {
+        ++dedupedBlobs;
+        dedupedBytes += text.size();
+    }
+    else {
+        Metrics::Timer timer(metrics, Metrics::Stage_blob);
+        blob_mark = output_blob(id);
+        if( ! no_dedup )
+            blobDigests.insert(digest, blob_mark);
+    }
+    ++pageRevisions;
+    PROBE2(revision, id, size);
+    Metrics::Timer timer(metrics, Metrics::Stage_build);
+    return buildCommitString(date, blob_mark);
 }
 
 // Is called whenever a revision tag was closed.
 static void newRevision(void)
 {
-    output_blob();
+    uint64_t started = metrics.isEnabled() ? Metrics::wallNow() : 0;
+    unsigned long id = boost::lexical_cast<unsigned long>(id_revision);
     std::time_t date = time_t_from_timestamp();
-    if( ! tempfilename.empty() )
-        revisionPositions.insert(ForSortingPos(date, boost::lexical_cast<unsigned long>(id_revision), writeString(buildCommitString(date))));
-    else
-        revisions.insert(ForSortingString(date, boost::lexical_cast<unsigned long>(id_revision), buildCommitString(date)));
+    if( columns )
+        addColumns(id, date, metadata_only ? textBytes : text.size());
+    std::string str(revisionCommit(id, date));
+    // Snapshots are only using the file.
+    if( interval != Interval_none )
+        str = str.substr(str.rfind('\n')+1);
+    {
+        Metrics::Timer timer(metrics, Metrics::Stage_sort);
+        if( ! tempfilename.empty() )
+            revisionPositions.insert(ForSortingPos(date, id, writeString(str)));
+        else {
+            commitStoreBytes += str.capacity();
+            revisions.insert(ForSortingString(date, id, str));
+        }
+    }
+    ++revisions_read;
+    // Reading the RSS isn't free, so we check only every 1024 revisions.
+    if( memory_budget && tempfilename.empty() && ! (revisions_read & 1023)
+            && rssBytes() >> 20 >= memory_budget * 9 / 10 )
+        spill();
+    if( started )
+        metrics.revision(Metrics::wallNow() - started);
+}
+
+static void indexRevision(void)
+{
+    if( indexedPage != pages_read ) {
+        indexedPage = pages_read;
+        indexPages.push_back(IndexPage());
+        indexPages.back().title = title;
+        indexPages.back().title_ns = title_ns;
+        indexPages.back().id = id_page;
+    }
+    unsigned long id = boost::lexical_cast<unsigned long>(id_revision);
+    std::time_t date = time_t_from_timestamp();
+    if( columns )
+        addColumns(id, date, textBytes);
+    if( id > 0xffffffffUL ) {
+        std::cerr << "ERROR: Revision id " << id << " doesn't fit into the index of --two-pass!" << std::endl;
+        exit(4);
+    }
+    revisionIndex.push_back(IndexEntry(revisionOffset, date, id, indexPages.size() - 1));
+    pageBytes += textBytes;
+    ++pageRevisions;
     ++revisions_read;
 }
 
-static void showStats(void)
+static std::string write_commit(const std::string& str,
+    const std::string& from, unsigned long id); // see below
+
+static void emitRevision(XML_Parser parser)
+{
+    unsigned long id = boost::lexical_cast<unsigned long>(id_revision);
+    std::string str(revisionCommit(id, time_t_from_timestamp()));
+    emitFrom = write_commit(str, emitFrom, id);
+    // Stop before expat complains about the following revision.
+    revisionDone = true;
+    XML_StopParser(parser, XML_FALSE);
+}
+
+// Called at the end of every page.
+static void pageDone(void)
+{
+    if( pageRevisions > 1 )
+        ++multiRevisionPages;
+    if( pages_read ) {
+        metrics.pageSize(title_ns.empty() ? title : title_ns + ':' + title, pageBytes);
+        PROBE2(page_end, title.c_str(), pageRevisions);
+    }
+    pageBytes = 0;
+    pageRevisions = 0;
+}
+
+static uint64_t titleHash(const std::string& str)
+{
+    // FNV-1a
+    uint64_t h(14695981039346656037ULL);
+    for( size_t i = 0; i < str.size(); ++i )
+        h = (h ^ (unsigned char)str[i]) * 1099511628211ULL;
+    return h;
+}
+
+static void ignoreThisPage(void)
+{
+    if( ! ignorePage ) {
+        ignorePage = true;
+        ++ignoredPages;
+    }
+}
+
+static bool pageIdWanted(unsigned long id)
+{
+    if( page_ids.empty() )
+        return true;
+    for( size_t i = 0; i < page_ids.size(); ++i )
+        if( id >= page_ids[i].first && id <= page_ids[i].second )
+            return true;
+    return false;
+}
+
+// Swaps the actual revision with a kept one.
+static void swapRevision(KeptRevision& kept)
+{
+    comment.swap(kept.comment);
+    ip.swap(kept.ip);
+    sha1.swap(kept.sha1);
+    text.swap(kept.text);
+    timestamp.swap(kept.timestamp);
+    username.swap(kept.username);
+    id_contributor.swap(kept.id_contributor);
+    id_revision.swap(kept.id_revision);
+    std::swap(is_minor, kept.is_minor);
+    std::swap(textBytes, kept.textBytes);
+    std::swap(revisionOffset, kept.offset);
+}
+
+static void keepRevision(void)
 {
-    unsigned long rev_now(revisions_read + ignoredRevisions);
-    std::cerr << "Revisions read: " << rev_now;
-    if( revisions_total && rev_now ) {
-        std::cerr << '/' << revisions_total;
-        std::cerr << " (ETA "
-            << boost::posix_time::to_simple_string(
-                (boost::posix_time::second_clock::local_time() - time_start)
-                * (double)(revisions_total-rev_now)/rev_now )
-            << ')' << std::endl;
+    keptRevisions.push_back(KeptRevision());
+    swapRevision(keptRevisions.back());
+    if( keptRevisions.size() > keep_last ) {
+        keptRevisions.pop_front();
+        ++droppedRevisions;
     }
+}
+
+static void takeRevision(void)
+{
+    if( reading == Reading_index )
+        indexRevision();
+    else
+        newRevision();
+}
+
+// Called at the end of every page with --keep-last.
+static void importKeptRevisions(void)
+{
+    for( size_t i = 0; i < keptRevisions.size(); ++i ) {
+        swapRevision(keptRevisions[i]);
+        takeRevision();
+    }
+    keptRevisions.clear();
+}
+
+// A revision which passed the filters and the squashing.
+static void passRevision(void)
+{
+    if( keep_last )
+        keepRevision();
     else
-        std::cerr << std::endl;
+        takeRevision();
+}
+
+// Passes the squashed revision on, the actual one is kept.
+static void importSquashed(void)
+{
+    KeptRevision actual;
+    swapRevision(actual);
+    swapRevision(squashed);
+    passRevision();
+    swapRevision(actual);
+    squashing = false;
+}
+
+// Rounds down (instead of towards zero), dates before 1970 are negative.
+static long floorDiv(std::time_t a, std::time_t b)
+{
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+// The number of the snapshot containing date.
+static long snapshotOf(std::time_t date)
+{
+    if( interval == Interval_all )
+        return 0;
+    if( interval == Interval_month ) {
+        struct tm tm;
+        gmtime_r(&date, &tm);
+        return (tm.tm_year + 1900) * 12L + tm.tm_mon;
+    }
+    // Weeks are starting on monday, 1970-01-05 was one.
+    if( interval == Interval_week )
+        return floorDiv(date - 4 * 86400, 7 * 86400);
+    return floorDiv(date, snapshotSeconds);
+}
+
+// The time a snapshot ends (and the next one starts).
+static std::time_t snapshotEnd(long snapshot)
+{
+    if( interval == Interval_month ) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        tm.tm_year = (snapshot + 1) / 12 - 1900;
+        tm.tm_mon = (snapshot + 1) % 12;
+        tm.tm_mday = 1;
+        return timegm(&tm);
+    }
+    if( interval == Interval_week )
+        return (snapshot + 1) * 7 * 86400 + 4 * 86400;
+    return (snapshot + 1) * std::time_t(snapshotSeconds);
+}
+
+static void squashRevision(void)
+{
+    std::time_t date = time_t_from_timestamp();
+    if( squashing && interval != Interval_none
+            && snapshotOf(date) == snapshotOf(squashedDate) ) {
+        ++supersededRevisions;
+        // The timestamps of a page aren't always in order, we keep the
+        // revision which is sorted last.
+        if( date < squashedDate || ( date == squashedDate
+                && boost::lexical_cast<unsigned long>(id_revision)
+                    < boost::lexical_cast<unsigned long>(squashed.id_revision) ) )
+            return;
+    }
+    else if( squashing && squash_window && username == squashed.username && ip == squashed.ip
+            && date - squashedDate <= std::time_t(squash_window) ) {
+        if( comment.empty() )
+            comment.swap(squashed.comment);
+        else if( ! squashed.comment.empty() )
+            comment = squashed.comment + '\n' + comment;
+        is_minor = is_minor && squashed.is_minor;
+        ++squashedRevisions;
+    }
+    else if( squashing )
+        importSquashed();
+    squashed = KeptRevision();
+    swapRevision(squashed);
+    squashing = true;
+    squashedDate = date;
 }
 
 // Callbacks for expat
 
-static void XMLCALL startElement(void *, const char *name, const char **)
+static void XMLCALL characterHandler(void *, const char *txt, int txtlen)
+{
+    actualValue += std::string(txt, txtlen);
+}
+
+static void XMLCALL countingHandler(void *, const char *, int txtlen)
+{
+    textBytes += txtlen;
+}
+
+// Called for every started element, by startElement() or by replayCache().
+static void elementStarted(void *parser, Element element)
 {
     actualValue.clear();
-    MapElementsKeyString::const_iterator ei=mapElementNames.find(name);
-    if( ei != mapElementNames.end()) {
-        //std::cerr << "Element: '" << name << '\'' << std::endl;
-        elementStack.push(ei->second);
-        if( elementStack.size() == 3 && ei->second == Element_revision ) {
+    if( cacheOut ) {
+        if( element == Element_page && elementStack.size() == 1 )
+            cacheOut->beginPage();
+        else if( element == Element_revision && elementStack.size() == 2 )
+            cacheOut->beginRevision();
+        cacheOut->start(element);
+    }
+    elementStack.push(element);
+    if( element != Element_unknown ) {
+        if( elementStack.size() == 3 && element == Element_revision ) {
+            if( reading == Reading_index )
+                revisionOffset = indexBase + XML_GetCurrentByteIndex(static_cast<XML_Parser>(parser));
+            if( layout == Layout_balanced && ! ignorePage && ! titleBalanced && reading != Reading_emit ) {
+                balancedTitles.push_back(title_ns + '/' + asciiize(title));
+                balancedTitlesBytes += sizeof(std::string) + balancedTitles.back().capacity();
+                titleBalanced = true;
+            }
             comment.clear();
             ip.clear();
+            sha1.clear();
             text.clear();
             timestamp.clear();
             username.clear();
             is_minor = false;
             is_del = false;
+            skipRevision = false;
+            textBytes = 0;
         }
+        // The cache needs all texts.
+        else if( ( metadata_only || reading == Reading_index
+                    || ( ( ignorePage || skipRevision ) && ! cacheOut ) )
+                && elementStack.size() == 4 && element == Element_text ) {
+            textBytes = 0;
+            countingText = true;
+            XML_SetCharacterDataHandler(static_cast<XML_Parser>(parser), countingHandler);
+        }
+        else if( no_redirects && elementStack.size() == 3 && element == Element_redirect )
+            ignoreThisPage();
     }
-    else {
-        //std::cerr << "Unknown element: '" << name << '\'' << std::endl;
-        elementStack.push(Element_unknown);
-    }
 }
 
-static void XMLCALL endElement(void *, const char *name)
+static void XMLCALL startElement(void *parser, const char *name, const char **)
+{
+    MapElementsKeyString::const_iterator ei=mapElementNames.find(name);
+    elementStarted(parser, ei != mapElementNames.end() ? ei->second : Element_unknown);
+}
+
+static void XMLCALL endElement(void *parser, const char *)
 {
+    if( cacheOut ) {
+        static const std::string none;
+        Element e(elementStack.top());
+        cacheOut->end(e == Element_unknown || e == Element_revision || e == Element_page
+            ? none : actualValue);
+    }
     switch(elementStack.top()) {
         case Element_comment:
             if( elementStack.size() == 4 ) // below revision
@@ -451,104 +1563,702 @@ static void XMLCALL endElement(void *, const char *name)
                 id_revision.swap(actualValue);
             else if( elementStack.size() == 5 ) // below contributor
                 id_contributor.swap(actualValue);
-            else if( elementStack.size() == 3 ) // below page
+            else if( elementStack.size() == 3 ) { // below page
                 id_page.swap(actualValue);
+                if( ! pageIdWanted(boost::lexical_cast<unsigned long>(id_page)) )
+                    ignoreThisPage();
+                if( cacheOut )
+                    cacheOut->indexPage(boost::lexical_cast<unsigned long>(id_page),
+                        title_ns.empty() ? title : title_ns + ':' + title);
+            }
            break;
         case Element_ip:
             if( elementStack.size() == 5  || elementStack.size() == 6 ) // below contributor or below username
                 ip.swap(actualValue);
             break;
         case Element_minor:
-            if( elementStack.size() == 4 ) // below revision
+            if( elementStack.size() == 4 ) { // below revision
                 is_minor = true;
+                if( no_minor )
+                    skipRevision = true;
+            }
             break;
-        case Element_text:
+        case Element_sha1:
             if( elementStack.size() == 4 ) // below revision
+                sha1.swap(actualValue);
+            break;
+        case Element_text:
+            if( elementStack.size() == 4 && countingText ) {
+                countingText = false;
+                XML_SetCharacterDataHandler(static_cast<XML_Parser>(parser), characterHandler);
+            }
+            else if( elementStack.size() == 4 ) // below revision
                 text.swap(actualValue);
             break;
         case Element_revision:
             if( elementStack.size() == 3 ) { // below page
-                if( ! ignorePage )
-                    newRevision();
-                else
+                if( ignorePage )
                     ++ignoredRevisions;
+                else if( skipRevision )
+                    ++skippedRevisions;
+                else if( ( squash_window || interval != Interval_none ) && reading != Reading_emit )
+                    squashRevision();
+                else if( keep_last && reading != Reading_emit )
+                    keepRevision();
+                else if( reading == Reading_index )
+                    indexRevision();
+                else if( reading == Reading_emit )
+                    emitRevision(static_cast<XML_Parser>(parser));
+                else
+                    newRevision();
             }
             break;
         case Element_timestamp:
-            if( elementStack.size() == 4 ) // below revision
+            if( elementStack.size() == 4 ) { // below revision
                 timestamp.swap(actualValue);
+                if( ( ! since.empty() && timestamp < since )
+                        || ( ! until.empty() && timestamp >= until ) )
+                    skipRevision = true;
+            }
             break;
         case Element_title:
             if( elementStack.size() == 3 ) { // below page
-                showStats();
+                pageDone();
                 title.swap(actualValue);
-                std::cerr << "Processing page " << title << std::endl;
+                ++pages_read;
+                PROBE1(page_start, title.c_str());
+                if( verbose )
+                    std::cerr << "Processing page " << title << '\n';
+                pageBase = PackWriter::Base();
                 ignorePage = false;
+                titleBalanced = false;
+                if( ! pages_file.empty() && ! std::binary_search(allowedTitles.begin(),
+                        allowedTitles.end(), titleHash(title)) )
+                    ignoreThisPage();
                 size_t colon = title.find(':');
                 if( colon != std::string::npos ) {
                     title_ns = title.substr(0, colon);
-                    if( ns_blacklist.find(title_ns) != ns_blacklist.end() ) {
-                        ignorePage = true;
-                        ++ignoredPages;
-                    }
+                    if( ns_blacklist.find(title_ns) != ns_blacklist.end() )
+                        ignoreThisPage();
                     // TODO: We should check if this is a namespace
                     // (which would require to read the namespaces).
                     title.erase(0, colon+1);
                 }
                 else
                     title_ns.clear();
-                if( ignorePage )
-                    std::cerr << "(blacklisted => ignored)" << std::endl;
+                if( ignorePage && verbose )
+                    std::cerr << "(blacklisted or filtered => ignored)\n";
             }
             break;
         case Element_username:
             if( elementStack.size() == 5 ) // below contributor
                 username.swap(actualValue);
             break;
+        case Element_page:
+            if( elementStack.size() == 2 && squashing )
+                importSquashed();
+            if( elementStack.size() == 2 && ! keptRevisions.empty() )
+                importKeptRevisions();
+            break;
        default:
             break;
     }
     elementStack.pop();
 }
 
-static void XMLCALL characterHandler(void *, const char *txt, int txtlen)
+// Reads the elements from the cache instead of the XML. If only some pages
+// are wanted, only the blocks containing them are read.
+static void replayCache(XML_Parser parser, Reporter::Read& read)
 {
-    actualValue += std::string(txt, txtlen);
+    CacheReader cache(cache_file);
+    if( ! pages_file.empty() || ! page_ids.empty() ) {
+        const std::vector<CacheReader::Page>& pages(cache.pages());
+        for( size_t i = 0; i < pages.size(); ++i )
+            if( pageIdWanted(pages[i].id) && ( pages_file.empty()
+                    || std::binary_search(allowedTitles.begin(), allowedTitles.end(),
+                        titleHash(pages[i].title)) ) )
+                cache.want(pages[i].block);
+    }
+    Metrics::Timer timer(metrics, Metrics::Stage_parse);
+    unsigned char element;
+    const char* value;
+    size_t size;
+    for( unsigned long events = 1; revisions_read < max_revisions; ++events ) {
+        CacheReader::Event event(cache.next(element, value, size));
+        if( event == CacheReader::Event_eof )
+            break;
+        if( event == CacheReader::Event_start )
+            elementStarted(parser, Element(element));
+        else {
+            if( size && countingText )
+                countingHandler(NULL, value, size);
+            else if( size )
+                characterHandler(NULL, value, size);
+            endElement(parser, NULL);
+        }
+        if( ! (events & 0xffff) ) {
+            read.pages = pages_read;
+            read.revisions = revisions_read + ignoredRevisions + skippedRevisions + droppedRevisions
+                + squashedRevisions + supersededRevisions;
+            read.bytes = read.position = cache.position();
+            reporter->read(read);
+        }
+    }
+}
+
+// Step 2 of --two-pass. Every revision is parsed again from its offset in
+// stdin by a fresh parser, starting below the page.
+static int emitRevisions(XML_Parser parser)
+{
+    reading = Reading_emit;
+    std::sort(revisionIndex.begin(), revisionIndex.end());
+    // Every revision might need a blob.
+    commitMarkBase = revisionIndex.size();
+    size_t count = std::min(revisionIndex.size(), max_revisions);
+    for( size_t i = 0; i < count; ++i ) {
+        const IndexEntry& entry(revisionIndex[i]);
+        // The page has passed all filters in step 1, whatever the last
+        // page read there was.
+        const IndexPage& page(indexPages[entry.page]);
+        title = page.title;
+        title_ns = page.title_ns;
+        id_page = page.id;
+        ignorePage = false;
+        XML_ParserReset(parser, NULL);
+        XML_SetElementHandler(parser, startElement, endElement);
+        XML_SetCharacterDataHandler(parser, characterHandler);
+        XML_SetUserData(parser, parser);
+        elementStack = std::stack<Element>();
+        elementStack.push(Element_unknown);
+        elementStack.push(Element_unknown);
+        revisionDone = false;
+        uint64_t offset(entry.offset);
+        while( ! revisionDone ) {
+            void* parseBuffer(XML_GetBuffer(parser, 65536));
+            ssize_t got;
+            {
+                Metrics::Timer timer(metrics, Metrics::Stage_decompress);
+                got = pread(STDIN_FILENO, parseBuffer, 65536, offset);
+            }
+            if( got <= 0 ) {
+                std::cerr << "ERROR: Can't read revision " << entry.id << " from stdin!" << std::endl;
+                return 1;
+            }
+            offset += got;
+            Metrics::Timer timer(metrics, Metrics::Stage_parse);
+            if( XML_ParseBuffer(parser, got, 0) == XML_STATUS_ERROR && ! revisionDone ) {
+                std::cerr << XML_ErrorString(XML_GetErrorCode(parser)) << std::endl;
+                return 1;
+            }
+        }
+    }
+    return 0;
 }
 
 static void printMemInfo(void)
 {
-    // See http://www.gnu.org/software/libc/manual/html_node/Statistics-of-Malloc.html
-    // and have a look at /usr/include/malloc.h.
-    struct mallinfo info = mallinfo();
-    // This is the total size of memory allocated with sbrk (not mmaped) by malloc
-    // plus size of memory allocated with mmap, both in bytes.
-    std::cerr << "Allocated 1: " << info.arena+info.hblkhd << " Bytes" << std::endl;
-    // This is the total size of memory occupied by chunks handed out by malloc and
-    // mmap.
-    std::cerr << "Allocated 2: " << info.uordblks+info.hblkhd << " Bytes" << std::endl;
+    // The sizes of the containers are estimated, a node of a std::set
+    // needs 4 pointers (incl. the color) besides the value.
+    std::cerr << "Memory used (MB): revision index "
+        << ((revisions.size() * (sizeof(ForSortingString) + 32)
+            + revisionPositions.size() * (sizeof(ForSortingPos) + 32)
+            + revisionIndex.capacity() * sizeof(IndexEntry)) >> 20)
+        << ", commits " << (commitStoreBytes >> 20)
+        << ", parser " << ((BUFFER_SIZE + actualValue.capacity() + text.capacity()) >> 20)
+        << ", dedup table " << (blobDigests.bytes() >> 20);
+    if( balancedTitlesBytes )
+        std::cerr << ", titles " << (balancedTitlesBytes >> 20);
+    std::cerr << ", RSS " << (rssBytes() >> 20) << " (peak " << (peakRssBytes() >> 20) << ')';
+    uint64_t limit = cgroupLimitBytes();
+    if( limit )
+        std::cerr << ", cgroup limit " << (limit >> 20);
+    if( memory_budget )
+        std::cerr << ", budget " << memory_budget;
+    std::cerr << std::endl;
 }
 
-static std::string output_commit(const std::string& str,
-    const std::string& from)
+// Returns the mark of the commit (":mark") to be used as from for the next.
+// files are additional lines (M ...) to be written with the first commit.
+template<class Out>
+static std::string output_commit(Out& out, const std::string& ref,
+    const std::string& str, const std::string& from, const std::string& files,
+    unsigned long mark)
 {
-    std::cout << "commit refs/heads/master\n";
+    out.write("commit ");
+    out.write(ref);
+    out.write("\nmark :");
+    out.writeNumber(mark);
+    out.write('\n');
     // Get the start of the line beginning with M 100644 :mark.
-    // Used to insert From and to get the mark.
+    // Used to insert From.
     size_t m_start = str.rfind('\n')+1;
-    size_t mark_start = str.find(':', m_start)+1;
-    size_t mark_end = str.find(' ', mark_start);
-    assert( mark_end != std::string::npos );
-    // This moves the mark from the blob to the commit.
-    std::cout << "mark :" << str.substr(mark_start, mark_end-mark_start) << '\n';
     if( !from.empty() ) {
-        std::cout << str.substr(0, m_start);
-        std::cout << "from :" << from << '\n';
-        std::cout << str.substr(m_start) << '\n';
+        out.write(str.data(), m_start);
+        out.write("from ");
+        out.write(from);
+        out.write('\n');
+        out.write(str.data() + m_start, str.size() - m_start);
+    }
+    else if( ! files.empty() ) {
+        out.write(str.data(), m_start);
+        out.write(files);
+        out.write(str.data() + m_start, str.size() - m_start);
     }
     else
-        std::cout << str << '\n';
-    return str.substr(mark_start, mark_end-mark_start);
+        out.write(str);
+    out.write('\n');
+    return ':' + boost::lexical_cast<std::string>(mark);
+}
+
+class CommitWriter {
+    public:
+        CommitWriter(const std::string& s, const std::string& f, unsigned long m)
+            : str(s), from(f), mark(m) {}
+        template<class Out>
+        void operator()(Out& out) {
+            result = output_commit(out, "refs/heads/master", str, from, "", mark);
+        }
+        std::string result; // the mark of the commit
+    private:
+        const std::string& str;
+        const std::string& from;
+        unsigned long mark;
+};
+
+static std::string output_commit(const std::string& str,
+    const std::string& from)
+{
+    CommitWriter writer(str, from, commitMarkBase + ++commitMarks);
+    withOutput(writer);
+    if( importControl )
+        importControl->written(*output, str.size(), true);
+    return writer.result;
+}
+
+// The same as output_commit(), but the commit (and its trees) are written
+// into the pack. Returns the hash of the commit.
+static std::string pack_commit(const std::string& str,
+    const std::string& from)
+{
+    // See buildCommitString() for the format of str.
+    size_t m_start = str.rfind('\n')+1;
+    size_t mark_start = str.find(':', m_start)+1;
+    size_t path_start = str.find(' ', mark_start)+1;
+    packTree->set(str.substr(path_start), pack->sha1(
+        boost::lexical_cast<size_t>(str.substr(mark_start, path_start-1-mark_start))));
+    boost::shared_ptr<std::string> commit(new std::string("tree "));
+    *commit += packTree->write().hex() + '\n';
+    if( !from.empty() )
+        *commit += "parent " + from + '\n';
+    // Author and committer are already in the format git uses.
+    size_t data_start = str.find("\ndata ")+1;
+    commit->append(str, 0, data_start);
+    *commit += '\n';
+    size_t msg_start = str.find('\n', data_start)+1;
+    commit->append(str, msg_start,
+        boost::lexical_cast<size_t>(str.substr(data_start+5, msg_start-1-data_start-5)));
+    PackWriter::Sha1 sha1(PackWriter::hash(PackWriter::Type_commit, *commit));
+    pack->add(PackWriter::Type_commit, commit, NULL, &sha1);
+    return sha1.hex();
+}
+
+static std::string write_commit(const std::string& str,
+    const std::string& from, unsigned long id)
+{
+    Metrics::Timer timer(metrics, Metrics::Stage_commit);
+    PROBE1(commit, id);
+    reporter->written();
+    if( markTable.isOpen() )
+        markTable.add(id);
+    if( layout == Layout_balanced ) {
+        if( pack )
+            return pack_commit(balance(str), from);
+        return output_commit(balance(str), from);
+    }
+    if( pack )
+        return pack_commit(str, from);
+    return output_commit(str, from);
+}
+
+// Sharded output: the sorted commits are cut into shards (time ranges)
+// and every shard is written by its own git fast-import, all running in
+// parallel. The first commit of a shard contains all files existing at
+// that time. Afterwards the shards are stitched together by a last
+// git fast-import, which only has to write commits with the already
+// existing trees.
+// A commit id depends on its parent, so this rewrites (in one thread) all
+// commits but those of the first shard. We accept this, because commits
+// are small compared to the trees and blobs, which are all reused. The
+// original commits of the shards are unreachable afterwards and are
+// dropped by a git repack, which also puts all shards into one pack.
+
+static std::string commitString(const ForSortingString& r, std::istream&)
+{
+    if( layout == Layout_balanced )
+        return balance(r.str);
+    return r.str;
+}
+
+static std::string commitString(const ForSortingPos& r, std::istream& f)
+{
+    if( layout == Layout_balanced )
+        return balance(readString(f, r.pos));
+    return readString(f, r.pos);
+}
+
+static std::string shardRef(unsigned shard)
+{
+    if( ! shard )
+        return "refs/heads/master";
+    return "refs/wp2git/shard-" + boost::lexical_cast<std::string>(shard);
+}
+
+static std::string blobMarksFile(void)
+{
+    // We keep the name, tempfilename might be set later by spill().
+    static const std::string name(
+        (tempfilename.empty() ? std::string("wp2git") : tempfilename) + ".blob-marks");
+    return name;
+}
+
+static void openTempfile(std::ifstream& f)
+{
+    if( tempfilename.empty() )
+        return;
+    f.exceptions( std::fstream::failbit | std::fstream::badbit );
+    try {
+        f.open(tempfilename, std::fstream::binary | std::fstream::in);
+    }
+    catch (std::exception& e) {
+        // e.what() offers only cryptic errors here
+        std::cerr << "ERROR: Can't open file '" << tempfilename << "'!" << std::endl;
+        exit(2);
+    }
+}
+
+template<class Set>
+static void writeShard(unsigned shard, typename Set::const_iterator begin,
+    typename Set::const_iterator end, unsigned long mark,
+    const std::string* files, int* rc)
+{
+    std::ifstream f;
+    openTempfile(f);
+    std::vector<std::string> args;
+    args.push_back("fast-import");
+    args.push_back("--quiet");
+    args.push_back("--import-marks=" + blobMarksFile());
+    GitProcess git(args, GitProcess::Pipe_stdin);
+    ImportControl control(git, "shard " + boost::lexical_cast<std::string>(shard));
+    std::string ref(shardRef(shard));
+    std::string from;
+    for( typename Set::const_iterator i = begin; i != end; ++i ) {
+        std::string str(commitString(*i, f));
+        from = output_commit(git.input(), ref, str, from, *files, mark++);
+        control.written(git.input(), str.size(), true);
+        PROBE1(commit, i->id);
+        reporter->written();
+    }
+    *rc = git.wait();
+    static boost::mutex mutex;
+    boost::mutex::scoped_lock lock(mutex);
+    waitedForGit += git.waited();
+}
+
+template<class Set>
+static int writeShards(const Set& set)
+{
+    typedef typename Set::const_iterator Iter;
+    size_t total = std::min(set.size(), max_revisions);
+    unsigned n = std::min(size_t(shards), total);
+    std::ifstream f;
+    openTempfile(f);
+
+    // Find the start of every shard and the files existing there.
+    std::vector<Iter> starts;
+    std::vector<unsigned long> firstMarks;
+    std::vector<std::string> files(n);
+    std::map<std::string, std::string> marks; // path -> blob mark
+    Iter i = set.begin();
+    for( size_t count = 0; count < total; ++count, ++i ) {
+        if( count * n / total == starts.size() ) {
+            starts.push_back(i);
+            firstMarks.push_back(blobMarks + count + 1);
+            std::string& fs = files[starts.size()-1];
+            for( std::map<std::string, std::string>::const_iterator m = marks.begin();
+                    m != marks.end(); ++m )
+                fs += "M 100644 " + m->second + ' ' + m->first + '\n';
+        }
+        std::string str(commitString(*i, f));
+        size_t m_start = str.rfind('\n')+1;
+        size_t mark_start = str.find(':', m_start);
+        size_t path_start = str.find(' ', mark_start)+1;
+        marks[str.substr(path_start)] = str.substr(mark_start, path_start-1-mark_start);
+        if( markTable.isOpen() )
+            markTable.add(i->id);
+    }
+    marks.clear();
+    starts.push_back(i);
+
+    std::vector<int> rcs(n);
+    boost::thread_group group;
+    for( unsigned s = 0; s < n; ++s )
+        group.create_thread(boost::bind(&writeShard<Set>, s, starts[s], starts[s+1],
+            firstMarks[s], &files[s], &rcs[s]));
+    group.join_all();
+    files.clear();
+    for( unsigned s = 0; s < n; ++s )
+        if( rcs[s] ) {
+            std::cerr << "ERROR: git fast-import for shard " << s << " failed!" << std::endl;
+            return 7;
+        }
+    std::cerr << "Wrote " << n << " shards, stitching them together." << std::endl;
+
+    // Rewrite the commits of all shards but the first with the parent
+    // they should have.
+    std::vector<std::string> args;
+    args.push_back("fast-import");
+    args.push_back("--quiet");
+    GitProcess stitch(args, GitProcess::Pipe_stdin);
+    args.clear();
+    args.push_back("rev-parse");
+    args.push_back(shardRef(0));
+    std::string from(GitProcess::readLine(args));
+    for( unsigned s = 1; s < n; ++s ) {
+        args.clear();
+        args.push_back("log");
+        args.push_back("--reverse");
+        args.push_back("--format=%T");
+        args.push_back(shardRef(s));
+        GitProcess log(args, GitProcess::Pipe_stdout);
+        unsigned long mark(firstMarks[s]);
+        for( Iter c = starts[s]; c != starts[s+1]; ++c ) {
+            std::string tree;
+            std::getline(log.output(), tree);
+            std::string str(commitString(*c, f));
+            str.erase(str.rfind('\n')+1);
+            str += "M 040000 " + tree + " \"\"";
+            from = output_commit(stitch.input(), shardRef(0), str, from, "", mark++);
+        }
+        log.wait();
+    }
+    if( stitch.wait() ) {
+        std::cerr << "ERROR: git fast-import failed to stitch the shards!" << std::endl;
+        return 7;
+    }
+    waitedForGit += stitch.waited();
+    for( unsigned s = 1; s < n; ++s ) {
+        args.clear();
+        args.push_back("update-ref");
+        args.push_back("-d");
+        args.push_back(shardRef(s));
+        GitProcess::readLine(args);
+    }
+    std::cerr << "Repacking to drop the commits of the shards." << std::endl;
+    args.clear();
+    args.push_back("repack");
+    args.push_back("-a");
+    args.push_back("-d");
+    args.push_back("-q");
+    GitProcess repack(args, GitProcess::Pipe_stdout);
+    if( repack.wait() ) {
+        std::cerr << "ERROR: git repack failed!" << std::endl;
+        return 7;
+    }
+    return 0;
+}
+
+// Parallel step 2: the sorted commits are cut into batches, which are
+// formatted by a pool of worker threads while the main thread writes the
+// already formatted batches in order (like the PackWriter does with its
+// objects). The mark of every commit (and therefore the from of the next
+// one) is known in advance.
+// Only the main thread walks through the set and erases the written
+// revisions from it, the workers get pointers to the revisions of their
+// batch.
+
+static const size_t commitBatchSize(1024);
+
+template<class Set>
+class CommitFormatter {
+    public:
+        typedef typename Set::value_type Revision;
+        struct Batch {
+            std::vector<const Revision*> revisions;
+            unsigned long mark; // of the first commit
+            std::vector<std::string> commits;
+            bool done;
+        };
+        explicit CommitFormatter(unsigned threadCount)
+            : stopping(false)
+        {
+            for( unsigned i = 0; i < threadCount; ++i )
+                threads.create_thread(boost::bind(&CommitFormatter::worker, this));
+        }
+        ~CommitFormatter() {
+            {
+                boost::mutex::scoped_lock lock(mutex);
+                stopping = true;
+            }
+            cond.notify_all();
+            threads.join_all();
+        }
+        // Takes over the batch.
+        void add(Batch* batch) {
+            batch->done = false;
+            {
+                boost::mutex::scoped_lock lock(mutex);
+                queue.push_back(batch);
+                todo.push_back(batch);
+            }
+            cond.notify_all();
+        }
+        size_t queued(void) {
+            boost::mutex::scoped_lock lock(mutex);
+            return queue.size();
+        }
+        // Waits until the oldest batch is formatted and returns it (to be
+        // deleted by the caller), NULL if none is left.
+        Batch* next(void) {
+            boost::mutex::scoped_lock lock(mutex);
+            if( queue.empty() )
+                return NULL;
+            while( ! queue.front()->done )
+                cond.wait(lock);
+            Batch* batch = queue.front();
+            queue.pop_front();
+            return batch;
+        }
+    private:
+        void worker(void) {
+            std::ifstream f;
+            openTempfile(f);
+            for(;;) {
+                Batch* batch;
+                {
+                    boost::mutex::scoped_lock lock(mutex);
+                    while( todo.empty() && ! stopping )
+                        cond.wait(lock);
+                    if( todo.empty() )
+                        return;
+                    batch = todo.front();
+                    todo.pop_front();
+                }
+                format(*batch, f);
+                {
+                    boost::mutex::scoped_lock lock(mutex);
+                    batch->done = true;
+                }
+                cond.notify_all();
+            }
+        }
+        static void format(Batch& batch, std::istream& f) {
+            batch.commits.resize(batch.revisions.size());
+            unsigned long mark(batch.mark);
+            for( size_t n = 0; n < batch.revisions.size(); ++n, ++mark ) {
+                StringOutput out(batch.commits[n]);
+                std::string from;
+                if( mark > commitMarkBase + 1 )
+                    from = ':' + boost::lexical_cast<std::string>(mark - 1);
+                output_commit(out, "refs/heads/master", commitString(*batch.revisions[n], f),
+                    from, "", mark);
+            }
+        }
+        boost::mutex mutex;
+        boost::condition_variable cond;
+        std::deque<Batch*> todo; // not formatted by a worker
+        std::deque<Batch*> queue; // not written, in order
+        bool stopping;
+        boost::thread_group threads;
+};
+
+// Returns the mark of the last commit.
+template<class Set>
+static std::string writeCommits(Set& set, unsigned threadCount)
+{
+    typedef CommitFormatter<Set> Formatter;
+    size_t total = std::min(set.size(), max_revisions);
+    Formatter formatter(threadCount);
+    typename Set::iterator i = set.begin();
+    size_t added(0);
+    for(;;) {
+        // Two batches per worker, so they are busy while we are writing.
+        while( added < total && formatter.queued() < 2 * threadCount ) {
+            typename Formatter::Batch* batch = new typename Formatter::Batch;
+            size_t count = std::min(commitBatchSize, total - added);
+            batch->mark = commitMarkBase + added + 1;
+            for( size_t n = 0; n < count; ++n, ++i )
+                batch->revisions.push_back(&*i);
+            formatter.add(batch);
+            added += count;
+        }
+        typename Formatter::Batch* batch = formatter.next();
+        if( ! batch )
+            break;
+        Metrics::Timer timer(metrics, Metrics::Stage_commit);
+        std::vector<std::string>& commits(batch->commits);
+        for( size_t n = 0; n < commits.size(); ++n ) {
+            PROBE1(commit, batch->revisions[n]->id);
+            reporter->written();
+            if( markTable.isOpen() )
+                markTable.add(batch->revisions[n]->id);
+            size_t size(commits[n].size());
+            TextWriter writer(commits[n]);
+            withOutput(writer);
+            if( importControl )
+                importControl->written(*output, size, true);
+        }
+        commitMarks += commits.size();
+        // The batches are written in the order of the set.
+        typename Set::iterator end(set.begin());
+        std::advance(end, commits.size());
+        set.erase(set.begin(), end);
+        delete batch;
+    }
+    return ':' + boost::lexical_cast<std::string>(commitMarkBase + commitMarks);
+}
+
+// Step 2 with --snapshot-interval. Returns the mark of the last commit.
+template<class Set>
+static std::string writeSnapshots(Set& set)
+{
+    std::ifstream f;
+    openTempfile(f);
+    std::string from;
+    size_t total = std::min(set.size(), max_revisions);
+    typename Set::iterator i = set.begin();
+    for( size_t count = 0; count < total; ) {
+        long snapshot = snapshotOf(i->date);
+        std::map<std::string, std::string> files; // path -> M line
+        std::time_t last(0);
+        // tree_chunk is only set with --single-tree.
+        for( ; count < total && snapshotOf(i->date) == snapshot
+                && ( ! tree_chunk || files.size() < tree_chunk ); ++count ) {
+            last = i->date;
+            std::string str(commitString(*i, f));
+            size_t m_start = str.rfind('\n')+1;
+            size_t path_start = str.find(' ', str.find(':', m_start))+1;
+            files[str.substr(path_start)] = str.substr(m_start);
+            PROBE1(commit, i->id);
+            reporter->written();
+            set.erase(i++);
+        }
+        Metrics::Timer timer(metrics, Metrics::Stage_commit);
+        // A single tree is dated by its last revision.
+        std::time_t end = single_tree ? last : snapshotEnd(snapshot);
+        std::string str(commitHeader(committer, end));
+        std::string msg("Snapshot of " + boost::posix_time::to_iso_extended_string(
+            boost::posix_time::from_time_t(end)) + "\n\nwp2git " VERSION " import of "
+            + boost::lexical_cast<std::string>(files.size()) + " changed pages.\n");
+        str += "data " + boost::lexical_cast<std::string>(msg.size()) + '\n' + msg + '\n';
+        if( ! from.empty() )
+            str += "from " + from + '\n';
+        for( std::map<std::string, std::string>::const_iterator m = files.begin();
+                m != files.end(); ++m )
+            str += m->second + '\n';
+        str.erase(str.size()-1); // output_commit() adds it
+        from = output_commit(str, "");
+    }
+    return from;
 }
 
 static void readBlacklist(void)
@@ -571,6 +2281,39 @@ static void readBlacklist(void)
     blist.close();
 }
 
+// The file contains one title per line, as shown by MediaWiki (with
+// underscores or spaces).
+static void readPages(void)
+{
+    std::ifstream plist(pages_file.c_str());
+    if( ! plist ) {
+        std::cerr << "ERROR: Can't open file '" << pages_file << "'!" << std::endl;
+        exit(3);
+    }
+    std::string s;
+    while(std::getline(plist, s)) {
+        if( s.empty() )
+            continue;
+        std::replace(s.begin(), s.end(), '_', ' ');
+        allowedTitles.push_back(titleHash(s));
+    }
+    std::sort(allowedTitles.begin(), allowedTitles.end());
+    allowedTitles.erase(std::unique(allowedTitles.begin(), allowedTitles.end()),
+        allowedTitles.end());
+    std::cerr << "Importing only " << allowedTitles.size() << " pages." << std::endl;
+}
+
+// Writes what's left and remembers how long we had to wait for the reader.
+class OutputFlusher {
+    public:
+        template<class Out>
+        void operator()(Out& out) {
+            out.flush();
+            if( ! null_output )
+                metrics.waited(outputname.empty() ? "stdout" : outputname, out.waited());
+        }
+};
+
 int main(int argc, char** argv)
 {
     std::cerr << std::endl << "wp2git version " VERSION << std::endl;
@@ -582,11 +2325,14 @@ int main(int argc, char** argv)
 
     if( ! blacklist.empty() )
         readBlacklist();
+    if( ! pages_file.empty() )
+        readPages();
 
 
     std::cerr << "Step 1: Creating blobs." << std::endl;
 
     time_start = boost::posix_time::second_clock::local_time();
+    uint64_t wallStart(Metrics::wallNow());
 
     // Initialize the parser
     initMap();
@@ -594,6 +2340,19 @@ int main(int argc, char** argv)
     assert(parser);
     XML_SetElementHandler(parser, startElement, endElement);
     XML_SetCharacterDataHandler(parser, characterHandler);
+    // startElement() and endElement() are switching the character handler.
+    XML_SetUserData(parser, parser);
+
+    if( two_pass ) {
+        struct stat st;
+        if( fstat(STDIN_FILENO, &st) || ! S_ISREG(st.st_mode) ) {
+            std::cerr << "ERROR: --two-pass needs an uncompressed file as stdin!" << std::endl;
+            return 3;
+        }
+        indexBase = lseek(STDIN_FILENO, 0, SEEK_CUR);
+        reading = Reading_index;
+        std::cerr << "(only indexing the revisions)" << std::endl;
+    }
 
     // Open the file with bzip-decompressor or stdin
     std::istream* infile;
@@ -608,33 +2367,100 @@ int main(int argc, char** argv)
         infile = new std::istream(&in);
     }
 
-    // Open the temporary file
-    if( ! tempfilename.empty() ) {
-        tfile.exceptions( std::fstream::failbit | std::fstream::badbit );
-        //tfile.exceptions( std::ifstream::eofbit | std::fstream::failbit | std::fstream::badbit );
-        try {
-            tfile.open(tempfilename,
-                std::fstream::binary | std::fstream::in | std::fstream::out | std::fstream::trunc);
-        }
-        catch (std::exception& e) {
-            // e.what() offers only cryptic errors here
-            std::cerr << "ERROR: Can't open file '" << tempfilename << "'!" << std::endl;
-            return 2;
-        }
+    // The ETA is calculated by the position in the (compressed) input.
+    struct stat st;
+    uint64_t inputSize(0);
+    if( ! cache_file.empty() ? ! stat(cache_file.c_str(), &st)
+            : filename.empty() ? ! fstat(STDIN_FILENO, &st) : ! stat(filename.c_str(), &st) )
+        if( S_ISREG(st.st_mode) )
+            inputSize = st.st_size;
+    reporter = new Reporter(report_interval, inputSize, revisions_total);
+    Reporter::Read read;
+
+    if( ! packdir.empty() ) {
+        pack = new PackWriter(packdir, threads);
+        packTree = new TreeWriter(*pack);
     }
 
+    // The shards need the marks of the blobs.
+    GitProcess* blobImport(NULL);
+    if( shards > 1 || fast_import ) {
+        std::vector<std::string> args;
+        args.push_back("fast-import");
+        args.push_back("--quiet");
+        if( shards > 1 )
+            args.push_back("--export-marks=" + blobMarksFile());
+        else if( ! export_marks.empty() )
+            args.push_back("--export-marks=" + export_marks);
+        blobImport = new GitProcess(args, GitProcess::Pipe_stdin);
+        output = &blobImport->input();
+        importControl = new ImportControl(*blobImport, shards > 1 ? "blobs" : "wp2git");
+    }
+    else if( null_output )
+        nullOutput = new NullOutput("", "nothing");
+    else if( outputname.size() > 3 && ! outputname.compare(outputname.size()-3, 3, ".gz") )
+        gzipOutput = new GzipOutput(outputname, outputname);
+    else if( ! outputname.empty() )
+        fileOutput = new FileOutput(outputname, outputname);
+    else if( ! pack )
+        output = new Output(STDOUT_FILENO, "stdout");
+
+    if( ! mark_table.empty() )
+        markTable.open(mark_table);
+    if( ! columns_dir.empty() )
+        columns = new Columns(columns_dir);
+
+    // Open the temporary file
+    if( ! tempfilename.empty() )
+        openTfile();
+
+    if( ! build_cache.empty() )
+        cacheOut = new CacheWriter(build_cache);
+
     // Read, parse and output blobs.
-    while( *infile && revisions_read < max_revisions ) {
+    if( ! cache_file.empty() )
+        replayCache(parser, read);
+    while( cache_file.empty() && *infile && revisions_read < max_revisions ) {
         void* parseBuffer(XML_GetBuffer(parser, BUFFER_SIZE));
-        infile->read((char*)parseBuffer, BUFFER_SIZE);
+        {
+            Metrics::Timer timer(metrics, Metrics::Stage_decompress);
+            infile->read((char*)parseBuffer, BUFFER_SIZE);
+        }
+        Metrics::Timer timer(metrics, Metrics::Stage_parse);
+        PROBE1(parse_start, infile->gcount());
         if (XML_ParseBuffer(parser, infile->gcount(), 0) == XML_STATUS_ERROR) {
             std::cerr << XML_ErrorString(XML_GetErrorCode(parser)) << std::endl;
             return 1;
         }
+        PROBE1(parse_end, infile->gcount());
+        read.pages = pages_read;
+        read.revisions = revisions_read + ignoredRevisions + skippedRevisions + droppedRevisions
+                + squashedRevisions + supersededRevisions;
+        read.bytes += infile->gcount();
+        if( inputSize ) {
+            off_t pos = filename.empty() ? lseek(STDIN_FILENO, 0, SEEK_CUR) : off_t(file.tellg());
+            read.position = pos < 0 ? inputSize : pos;
+        }
+        reporter->read(read);
         if(revisions_read >= max_revisions)
             break; // This will create some more blobs, but we don't care.
     }
 
+    pageDone();
+
+    if( cacheOut ) {
+        delete cacheOut; // writes the index
+        cacheOut = NULL;
+        std::cerr << "Wrote the parsed dump into '" << build_cache << "'." << std::endl;
+    }
+
+    if( columns ) {
+        std::cerr << "Wrote the metadata of " << columns->count() << " revisions into '"
+            << columns_dir << "'." << std::endl;
+        delete columns;
+        columns = NULL;
+    }
+
     // Output commits.
 
     if( ! revisions_read ) {
@@ -642,22 +2468,86 @@ int main(int argc, char** argv)
         exit(0);
     }
 
+    if( blobImport && shards > 1 ) {
+        output = NULL;
+        delete importControl;
+        importControl = NULL;
+        if( blobImport->wait() ) {
+            std::cerr << "ERROR: git fast-import failed to import the blobs!" << std::endl;
+            return 7;
+        }
+        waitedForGit += blobImport->waited();
+        delete blobImport;
+        blobImport = NULL;
+    }
+
+    if( layout == Layout_balanced ) {
+        std::sort(balancedTitles.begin(), balancedTitles.end());
+        balancedTitles.erase(std::unique(balancedTitles.begin(), balancedTitles.end()),
+            balancedTitles.end());
+    }
+
     printMemInfo();
 
+    if( ! multiRevisionPages && revisions_read > 1 && interval == Interval_none && ! keep_last
+            && ! squash_window )
+        std::cerr << "The dump contains only one revision per page, --single-tree would be faster."
+            << std::endl;
+
     boost::posix_time::ptime time_start_step2(boost::posix_time::second_clock::local_time());
     std::cerr << "Time needed for step 1: " << boost::posix_time::to_simple_string(
         time_start_step2 - time_start) << std::endl;
 
     std::cerr << "Step 2: Writing " << std::min(revisions_read, max_revisions)
         << " commits." << std::endl;
+    reporter->writing(std::min(revisions_read, max_revisions));
 
-    if( ! tempfilename.empty() ) {
+    std::string from;
+    if( two_pass )
+        rc = emitRevisions(parser);
+    else
+        commitMarkBase = blobMarks;
+    if( rc )
+        return rc;
+    unsigned threadCount = commit_threads ? commit_threads
+        : std::max(1u, boost::thread::hardware_concurrency());
+    if( two_pass )
+        from = emitFrom;
+    else if( interval != Interval_none ) {
+        if( ! tempfilename.empty() ) {
+            tfile.close();
+            from = writeSnapshots(revisionPositions);
+        }
+        else
+            from = writeSnapshots(revisions);
+    }
+    else if( threadCount > 1 && shards <= 1 && ! pack ) {
+        if( ! tempfilename.empty() ) {
+            tfile.close();
+            from = writeCommits(revisionPositions, threadCount);
+        }
+        else
+            from = writeCommits(revisions, threadCount);
+    }
+    else if( shards > 1 ) {
+        Metrics::Timer timer(metrics, Metrics::Stage_commit);
+        if( ! tempfilename.empty() ) {
+            tfile.close();
+            rc = writeShards(revisionPositions);
+        }
+        else
+            rc = writeShards(revisions);
+        unlink(blobMarksFile().c_str());
+        if( rc )
+            return rc;
+    }
+    else if( ! tempfilename.empty() ) {
         RevisionPositions::iterator i = revisionPositions.begin();
-        std::string from(output_commit(readString(i->pos), ""));
+        from = write_commit(readString(i->pos), "", i->id);
         revisionPositions.erase(i++);
         RevisionPositions::const_iterator end = revisionPositions.end();
         for( size_t count = 1 ; i != end && count < max_revisions; ++count ) {
-            from = output_commit(readString(i->pos), from);
+            from = write_commit(readString(i->pos), from, i->id);
             revisionPositions.erase(i++);
         }
         tfile.close();
@@ -665,15 +2555,46 @@ int main(int argc, char** argv)
     }
     else {
         Revisions::iterator i = revisions.begin();
-        std::string from(output_commit(i->str, ""));
+        from = write_commit(i->str, "", i->id);
         revisions.erase(i++);
         Revisions::const_iterator end = revisions.end();
         for( size_t count = 1 ; i != end && count < max_revisions; ++count ) {
-            from = output_commit(i->str, from);
+            from = write_commit(i->str, from, i->id);
             revisions.erase(i++);
         }
     }
 
+    if( spilled )
+        unlink(tempfilename.c_str());
+
+    if( blobImport ) {
+        if( blobImport->wait() ) {
+            std::cerr << "ERROR: git fast-import failed!" << std::endl;
+            return 7;
+        }
+        waitedForGit += blobImport->waited();
+    }
+    else if( output || fileOutput || gzipOutput || nullOutput ) {
+        OutputFlusher flusher;
+        withOutput(flusher);
+        delete fileOutput;
+        delete gzipOutput; // finishes the compressed file
+        delete nullOutput;
+    }
+
+    if( markTable.isOpen() )
+        markTable.close(blobMarks);
+
+    if( pack ) {
+        Metrics::Timer timer(metrics, Metrics::Stage_pack);
+        pack->finish("refs/heads/master", from);
+        std::cerr << "Wrote " << pack->objects() << " objects (" << pack->deltas()
+            << " deltas) into a pack in '" << packdir << "'." << std::endl;
+    }
+
+    delete reporter;
+    reporter = NULL;
+
     printMemInfo();
 
     boost::posix_time::ptime time_end_step2(boost::posix_time::second_clock::local_time());
@@ -683,12 +2604,35 @@ int main(int argc, char** argv)
     std::cerr << "Time needed overall: " << boost::posix_time::to_simple_string(
         time_end_step2 - time_start) << std::endl;
 
+    if( metrics.isEnabled() ) {
+        if( shards > 1 || fast_import )
+            metrics.waited("git fast-import", waitedForGit);
+        if( ! metrics.write(metrics_file, (Metrics::wallNow() - wallStart) / 1e9) )
+            std::cerr << "ERROR: Can't write to file '" << metrics_file << "'!" << std::endl;
+    }
+
 
     std::cerr << "Processed " << std::min(revisions_read, max_revisions)
         << " revisions." << std::endl;
+    if( skippedRevisions )
+        std::cerr << "Skipped " << skippedRevisions << " filtered revisions." << std::endl;
+    if( squashedRevisions )
+        std::cerr << "Squashed " << squashedRevisions << " revisions into the following ones."
+            << std::endl;
+    if( supersededRevisions )
+        std::cerr << "Left out " << supersededRevisions << " revisions superseded by a later one of"
+            " their page in the same " << ( single_tree ? "tree." : "snapshot." ) << std::endl;
+    if( droppedRevisions )
+        std::cerr << "Dropped " << droppedRevisions << " revisions not being one of the last "
+            << keep_last << " of their page." << std::endl;
     if( ignoredPages )
-        std::cerr << "Ignored " << ignoredPages << " blacklisted pages (" << ignoredRevisions
+        std::cerr << "Ignored " << ignoredPages << " blacklisted or filtered pages (" << ignoredRevisions
             << " revisions)." << std::endl;
+    if( shards > 1 || fast_import )
+        std::cerr << "Waited " << waitedForGit << " s for git fast-import to read what we wrote." << std::endl;
+    if( dedupedBlobs )
+        std::cerr << "Deduplicated " << dedupedBlobs << " blobs (" << dedupedBytes
+            << " bytes not sent to git)." << std::endl;
     // Let the libc perform all the cleanup and just quit.
     return 0;
 }